@@ -0,0 +1,108 @@
+// ray box slab tests: the per test divide, aabb::hit with a prepared slab_ray, and the wide BVH node
+#include "bvh.h"
+
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+
+// slab test as it was before slab_ray: divides and branches on the sign for every box
+static bool divide_hit(const aabb &box, const ray &r, interval ray_t)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        auto inv_d = 1 / r.direction()[a];
+        auto orig = r.origin()[a];
+        auto t0 = (box.axis(a).min - orig) * inv_d;
+        auto t1 = (box.axis(a).max - orig) * inv_d;
+        if (inv_d < 0)
+            std::swap(t0, t1);
+        if (t0 > ray_t.min)
+            ray_t.min = t0;
+        if (t1 < ray_t.max)
+            ray_t.max = t1;
+        if (ray_t.max <= ray_t.min)
+            return false;
+    }
+    return true;
+}
+
+template <typename F>
+static void bench(const char *name, size_t tests, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    long hits = f();
+    auto end = std::chrono::steady_clock::now();
+    printf("%-8s %6.2f ns/box (%ld hits)\n", name, std::chrono::duration<double, std::nano>(end - start).count() / tests, hits);
+}
+
+int main()
+{
+    constexpr int n_boxes = 1024, n_rays = 4096;
+    const size_t tests = size_t(n_boxes) * n_rays;
+    const interval ray_t(0.001, inf);
+
+    vector<aabb> boxes;
+    for (int i = 0; i < n_boxes; i++)
+    {
+        point3 c(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1));
+        auto s = random_double(0.05, 0.5);
+        boxes.emplace_back(c - vec3(s, s, s), c + vec3(s, s, s));
+    }
+    vector<ray> rays;
+    for (int i = 0; i < n_rays; i++)
+        rays.emplace_back(point3(random_double(-3, 3), random_double(-3, 3), -5), random_unit_vector() + vec3(0, 0, 1));
+
+    vector<wide_bvh_node> nodes(n_boxes / bvh_width);
+    for (int i = 0; i < n_boxes; i++)
+    {
+        auto &node = nodes[i / bvh_width];
+        node.n_children = bvh_width;
+        for (int a = 0; a < 3; a++)
+        {
+            node.box_min[a][i % bvh_width] = boxes[i].axis(a).min;
+            node.box_max[a][i % bvh_width] = boxes[i].axis(a).max;
+        }
+    }
+
+    // twice, the first round warms up caches and clocks
+    for (int round = 0; round < 2; round++)
+    {
+        bench("divide", tests, [&]
+        {
+            long hits = 0;
+            for (const auto &r : rays)
+                for (const auto &box : boxes)
+                    hits += divide_hit(box, r, ray_t);
+            return hits;
+        });
+        bench("slab_ray", tests, [&]
+        {
+            long hits = 0;
+            for (const auto &r : rays)
+            {
+                slab_ray s(r);
+                for (const auto &box : boxes)
+                    hits += box.hit(s, ray_t);
+            }
+            return hits;
+        });
+        bench("wide", tests, [&]
+        {
+            long hits = 0;
+            alignas(32) double t_entry[bvh_width];
+            for (const auto &r : rays)
+            {
+                slab_ray s(r);
+                double4 orig[3], inv_dir[3];
+                for (int a = 0; a < 3; a++)
+                {
+                    orig[a] = double4(s.orig[a]);
+                    inv_dir[a] = double4(s.inv_dir[a]);
+                }
+                for (const auto &node : nodes)
+                    hits += std::bitset<bvh_width>(node.hit(orig, inv_dir, s.sign, ray_t, t_entry)).count();
+            }
+            return hits;
+        });
+    }
+}
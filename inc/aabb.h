@@ -1,6 +1,7 @@
 #pragma once
 
 #include "utils.h"
+#include "ray_packet.h"
 
 class aabb
 {
@@ -35,28 +36,70 @@ public:
         return x;
     }
 
-    bool hit(const ray &r, interval ray_t) const
+    point3 centroid() const
     {
-        for (int a = 0; a < 3; a++)
-        {
-            auto invD = 1 / r.direction()[a];
-            auto orig = r.origin()[a];
+        return point3((x.min + x.max) / 2, (y.min + y.max) / 2, (z.min + z.max) / 2);
+    }
+
+    int longest_axis() const
+    {
+        if (x.size() >= y.size())
+            return x.size() >= z.size() ? 0 : 2;
+        return y.size() >= z.size() ? 1 : 2;
+    }
 
-            auto t0 = (axis(a).min - orig) * invD;
-            auto t1 = (axis(a).max - orig) * invD;
+    double surface_area() const
+    {
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
 
-            if (invD < 0)
-                std::swap(t0, t1);
+    /**
+     * @brief slab test with the ray's precomputed inverse direction, the sign picks the near plane.
+     * A ray parallel to an axis with its origin on a slab plane gives a NaN distance; it fails both
+     * comparisons, so that slab is ignored and rays on the boundary count as inside
+     */
+    bool hit(const slab_ray &r, interval ray_t) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            const auto &slab = axis(a);
+            auto inv_d = r.inv_dir[a];
+            auto orig = r.orig[a];
+            auto t_near = ((r.sign[a] ? slab.max : slab.min) - orig) * inv_d;
+            auto t_far = ((r.sign[a] ? slab.min : slab.max) - orig) * inv_d;
+            ray_t.min = t_near > ray_t.min ? t_near : ray_t.min;
+            ray_t.max = t_far < ray_t.max ? t_far : ray_t.max;
+        }
+        return ray_t.min < ray_t.max;
+    }
 
-            if (t0 > ray_t.min)
-                ray_t.min = t0;
-            if (t1 < ray_t.max)
-                ray_t.max = t1;
+    // single test of a ray, prepare a slab_ray once when testing many boxes
+    bool hit(const ray &r, interval ray_t) const
+    {
+        return hit(slab_ray(r), ray_t);
+    }
 
-            if (ray_t.max <= ray_t.min)
-                return false;
+    /**
+     * @brief slab test of all packet lanes at once, NaN slab distances are ignored as in hit()
+     * @param t_max per lane upper bound of the ray interval
+     * @return bit mask of the lanes that overlap the box
+     */
+    int hit_packet(const ray_packet &rays, double t_min, const double *t_max) const
+    {
+        double4 lo(t_min), hi = double4::load(t_max);
+        for (int a = 0; a < 3; a++)
+        {
+            auto inv_d = rays.inv_direction(a);
+            auto orig = rays.origin(a);
+            auto t0 = (double4(axis(a).min) - orig) * inv_d;
+            auto t1 = (double4(axis(a).max) - orig) * inv_d;
+            auto negative = inv_d < double4(0.0);
+            // SIMD max / min return the second operand if either is NaN
+            lo = max(select(negative, t1, t0), lo);
+            hi = min(select(negative, t0, t1), hi);
         }
-        return true;
+        return movemask(lo < hi);
     }
 
     aabb pad(double delta = 0.0001)
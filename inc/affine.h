@@ -0,0 +1,137 @@
+#pragma once
+
+#include "utils.h"
+#include "aabb.h"
+
+/**
+ * @brief affine map p -> A p + b, stored as the 3x4 matrix [A | b] in row major order
+ */
+class affine
+{
+public:
+    double m[3][4];
+
+    // identity
+    affine() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static affine translation(const vec3 &offset)
+    {
+        affine t;
+        for (int i = 0; i < 3; i++)
+            t.m[i][3] = offset[i];
+        return t;
+    }
+
+    static affine scaling(const vec3 &factors)
+    {
+        affine s;
+        for (int i = 0; i < 3; i++)
+            s.m[i][i] = factors[i];
+        return s;
+    }
+
+    /**
+     * @brief counter-clockwise rotation around an axis through the origin (Rodrigues' formula)
+     * @param angle in degrees
+     */
+    static affine rotation(const vec3 &axis, double angle)
+    {
+        auto k = unit(axis);
+        auto rad = deg_to_rad(angle);
+        auto c = cos(rad), s = sin(rad);
+        double cross_k[3][3] = {{0, -k.z(), k.y()}, {k.z(), 0, -k.x()}, {-k.y(), k.x(), 0}};
+        affine r;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                r.m[i][j] = (i == j ? c : 0) + s * cross_k[i][j] + (1 - c) * k[i] * k[j];
+        return r;
+    }
+
+    static affine rotation_y(double angle)
+    {
+        auto rad = deg_to_rad(angle);
+        affine r;
+        r.m[0][0] = cos(rad);
+        r.m[0][2] = sin(rad);
+        r.m[2][0] = -sin(rad);
+        r.m[2][2] = cos(rad);
+        return r;
+    }
+
+    point3 point(const point3 &p) const
+    {
+        return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                      m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                      m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+
+    vec3 vector(const vec3 &v) const
+    {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    /**
+     * @brief multiply a normal by the transposed linear part. Normals of a surface moved by a map
+     * are transformed with the inverse of that map, so this is called on the inverse. Not normalized
+     */
+    vec3 normal(const vec3 &n) const
+    {
+        return vec3(m[0][0] * n[0] + m[1][0] * n[1] + m[2][0] * n[2],
+                    m[0][1] * n[0] + m[1][1] * n[1] + m[2][1] * n[2],
+                    m[0][2] * n[0] + m[1][2] * n[1] + m[2][2] * n[2]);
+    }
+
+    // inverse map, the linear part must not be singular
+    affine inverse() const
+    {
+        affine r;
+        auto det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                   m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                   m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        auto inv_det = 1 / det;
+        // adjugate: transposed cofactors
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+            {
+                int i1 = (j + 1) % 3, i2 = (j + 2) % 3;
+                int j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+                r.m[i][j] = (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) * inv_det;
+            }
+        for (int i = 0; i < 3; i++)
+            r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+        return r;
+    }
+
+    // bounding box of the 8 transformed corners of b
+    aabb box(const aabb &b) const
+    {
+        point3 lo(inf, inf, inf), hi(-inf, -inf, -inf);
+        for (int c = 0; c < 8; c++)
+        {
+            auto p = point(point3(c & 1 ? b.x.max : b.x.min,
+                                  c & 2 ? b.y.max : b.y.min,
+                                  c & 4 ? b.z.max : b.z.min));
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = fmin(lo[a], p[a]);
+                hi[a] = fmax(hi[a], p[a]);
+            }
+        }
+        return aabb(lo, hi);
+    }
+
+    // composition, a * b applies b first
+    friend affine operator*(const affine &a, const affine &b)
+    {
+        affine r;
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 4; j++)
+                r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+            r.m[i][3] += a.m[i][3];
+        }
+        return r;
+    }
+};
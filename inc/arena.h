@@ -0,0 +1,122 @@
+#pragma once
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief bump allocator for the objects of a scene. Objects are carved out of large blocks in the
+ * order they are created, so objects built together sit together in memory, and addresses never
+ * change. Nothing is freed one by one: the blocks are released at once when the arena goes away.
+ *
+ * Objects are made as shared_ptrs whose control block lives next to the object and holds on to the
+ * arena, so the arena stays alive until the last of its objects is released.
+ * Not thread safe, a scene is created by one thread at a time
+ */
+class scene_arena : public std::enable_shared_from_this<scene_arena>
+{
+private:
+    static constexpr size_t first_block = 64 * 1024;
+    static constexpr size_t max_block = 4 * 1024 * 1024;
+
+    vector<std::unique_ptr<char[]>> blocks;
+    char *current = nullptr;
+    size_t left = 0;
+    size_t next_block = first_block;
+    size_t used = 0;
+    size_t reserved = 0;
+
+    scene_arena() = default;
+
+public:
+    // arenas are only handled through shared_ptrs, which the objects made in them hold
+    static shared_ptr<scene_arena> create()
+    {
+        return shared_ptr<scene_arena>(new scene_arena());
+    }
+
+    void *allocate(size_t bytes, size_t align)
+    {
+        auto pad = (align - reinterpret_cast<uintptr_t>(current) % align) % align;
+        if (pad + bytes > left)
+        {
+            // large requests get a block of their own, so the current block stays in use
+            auto size = bytes + align > next_block / 2 ? bytes + align : next_block;
+            blocks.emplace_back(new char[size]);
+            reserved += size;
+            auto block = blocks.back().get();
+            if (size != next_block)
+            {
+                used += bytes;
+                return block + (align - reinterpret_cast<uintptr_t>(block) % align) % align;
+            }
+            next_block = std::min(2 * next_block, max_block);
+            current = block;
+            left = size;
+            pad = (align - reinterpret_cast<uintptr_t>(current) % align) % align;
+        }
+        auto p = current + pad;
+        current += pad + bytes;
+        left -= pad + bytes;
+        used += bytes;
+        return p;
+    }
+
+    size_t bytes_used() const { return used; }
+    size_t bytes_reserved() const { return reserved; }
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make(Args &&...args);
+};
+
+/**
+ * @brief standard allocator handing out arena memory, deallocation is left to the arena
+ */
+template <typename T>
+class arena_allocator
+{
+private:
+    template <typename U>
+    friend class arena_allocator;
+
+    shared_ptr<scene_arena> arena;
+
+public:
+    using value_type = T;
+
+    explicit arena_allocator(shared_ptr<scene_arena> arena) : arena(std::move(arena)) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template <typename U>
+    bool operator==(const arena_allocator<U> &other) const { return arena == other.arena; }
+
+    template <typename U>
+    bool operator!=(const arena_allocator<U> &other) const { return arena != other.arena; }
+};
+
+template <typename T, typename... Args>
+shared_ptr<T> scene_arena::make(Args &&...args)
+{
+    return std::allocate_shared<T>(arena_allocator<T>(shared_from_this()), std::forward<Args>(args)...);
+}
+
+// make_shared in the arena when there is one, on the heap otherwise
+template <typename T, typename... Args>
+shared_ptr<T> make_in(const shared_ptr<scene_arena> &arena, Args &&...args)
+{
+    if (arena)
+        return arena->make<T>(std::forward<Args>(args)...);
+    return make_shared<T>(std::forward<Args>(args)...);
+}
@@ -3,75 +3,864 @@
 #include "utils.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "primitive_array.h"
 
-#include <functional>
-#include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <thread>
 
+/**
+ * @brief 32 byte node of the binary BVH produced by the builder. Nodes are laid out depth first,
+ * so the first child of an interior node directly follows it. Bounds are floats rounded outwards
+ */
+struct alignas(32) linear_bvh_node
+{
+    float box_min[3];
+    float box_max[3];
+    uint32_t offset; // leaf: first primitive, interior: index of the second child
+    uint16_t count;  // number of primitives in a leaf, 0 for interior nodes
+    uint8_t axis;    // split axis of interior nodes
+    uint8_t pad;
+
+    bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "BVH nodes must stay 32 bytes");
+
+// children per node of the traversal tree, a multiple of the double4 width
+constexpr int bvh_width = 4;
+static_assert(bvh_width % 4 == 0, "wide BVH nodes are tested four children at a time");
+
+/**
+ * @brief node of the wide BVH that the binary tree is collapsed into for traversal. The child
+ * bounds are stored as structure of arrays, so one SIMD slab test covers four children.
+ * Children are packed at the front, the slots past n_children are never reported as hit
+ */
+struct alignas(64) wide_bvh_node
+{
+    float box_min[3][bvh_width];
+    float box_max[3][bvh_width];
+    uint32_t child[bvh_width]; // leaf child: first primitive, interior child: node index
+    uint16_t count[bvh_width]; // primitives of a leaf child, 0 for interior children
+    uint8_t n_children;
+
+    bool is_leaf(int i) const { return count[i] > 0; }
+
+    /**
+     * @brief slab test of one ray against all children
+     * @param t_entry receives the distance at which the ray enters each child
+     * @return mask of the children hit within ray_t
+     */
+    int hit(const double4 *orig, const double4 *inv_dir, const int *sign, interval ray_t, double *t_entry) const
+    {
+        int mask = 0;
+        for (int g = 0; g < bvh_width; g += 4)
+        {
+            double4 lo(ray_t.min), hi(ray_t.max);
+            for (int a = 0; a < 3; a++)
+            {
+                const float *near = sign[a] ? box_max[a] : box_min[a];
+                const float *far = sign[a] ? box_min[a] : box_max[a];
+                auto t_near = (double4::load(near + g) - orig[a]) * inv_dir[a];
+                auto t_far = (double4::load(far + g) - orig[a]) * inv_dir[a];
+                lo = max(t_near, lo); // NaN slabs are ignored, see aabb::hit
+                hi = min(t_far, hi);
+            }
+            lo.store(t_entry + g);
+            mask |= movemask(lo < hi) << g;
+        }
+        return mask & ((1 << n_children) - 1);
+    }
+
+    // slab test of child c against every lane of a packet, returns the lanes that hit
+    int hit_packet(int c, const ray_packet &rays, double t_min, const double *t_max, double *t_entry) const
+    {
+        double4 lo(t_min), hi = double4::load(t_max);
+        for (int a = 0; a < 3; a++)
+        {
+            auto inv_d = rays.inv_direction(a);
+            auto orig = rays.origin(a);
+            auto t0 = (double4(box_min[a][c]) - orig) * inv_d;
+            auto t1 = (double4(box_max[a][c]) - orig) * inv_d;
+            auto negative = inv_d < double4(0.0);
+            lo = max(select(negative, t1, t0), lo);
+            hi = min(select(negative, t0, t1), hi);
+        }
+        lo.store(t_entry);
+        return movemask(lo < hi);
+    }
+};
+
+enum class bvh_split
+{
+    median, // median of a random axis
+    sah     // binned surface area heuristic
+};
+
+struct bvh_build_options
+{
+    bvh_split split = bvh_split::sah;
+    int max_leaf_size = 4;          // larger nodes are always split
+    int n_bins = 16;                // SAH candidate planes per axis = n_bins - 1
+    double traversal_cost = 1.0;    // cost of visiting a node
+    double intersection_cost = 1.0; // cost of testing a primitive
+    int n_threads = 0;              // build threads, 0 uses every hardware thread
+};
 
-class bvh_node : public hittable
+// quality statistics of a built tree
+struct bvh_stats
+{
+    size_t nodes = 0;
+    size_t leaves = 0;
+    size_t primitives = 0;
+    int max_depth = 0;
+    double sah_cost = 0; // expected cost of a random ray hitting the root, in the build cost model
+    size_t wide_nodes = 0; // nodes after collapsing into the traversal tree
+};
+
+/**
+ * @brief flattened bounding volume hierarchy over an array of primitive bounds.
+ * A binary tree is built and then collapsed into bvh_width-ary nodes for traversal.
+ * It only orders primitives; what a primitive is and how it is intersected is up to the owner,
+ * which is called back with ranges of the primitive order for every leaf the ray reaches
+ */
+class bvh_accel
 {
 private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb bbox;
+    static constexpr int max_depth_sah = 40;
+    // of the binary tree, the builder keeps depth + ceil_log2(span) within it at every node. Every
+    // wide node level pushes at most bvh_width - 1 entries
+    static constexpr int max_depth = 64;
+    static constexpr int max_stack = max_depth * (bvh_width - 1) + 1;
+    static constexpr size_t parallel_grain = 1 << 12; // smallest range split across threads
+
+    vector<wide_bvh_node> nodes;
+    vector<uint32_t> order; // primitive indices in leaf order
+    bvh_stats build_stats;
+
+    // nodes adopted from memory owned elsewhere (a mapped snapshot) instead of the built ones
+    const wide_bvh_node *external_nodes = nullptr;
+    size_t external_count = 0;
+    shared_ptr<const void> backing;
+
+    static float round_down(double x)
+    {
+        auto f = static_cast<float>(x);
+        return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double x)
+    {
+        auto f = static_cast<float>(x);
+        return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static uint32_t make_node(vector<linear_bvh_node> &out, const aabb &box)
+    {
+        auto index = static_cast<uint32_t>(out.size());
+        out.emplace_back();
+        for (int a = 0; a < 3; a++)
+        {
+            out[index].box_min[a] = round_down(box.axis(a).min);
+            out[index].box_max[a] = round_up(box.axis(a).max);
+        }
+        return index;
+    }
+
+    // build time copy of a primitive's bounds, partitioned in place so that every pass over a range
+    // reads memory sequentially instead of gathering through the index order
+    struct build_primitive
+    {
+        aabb box;
+        uint32_t index;
+    };
+
+    struct bin
+    {
+        aabb box;
+        size_t count = 0;
+    };
+
+    // bounds of a primitive range and of its centroids
+    struct range_bounds
+    {
+        aabb box, centroids;
+    };
+
+    /**
+     * @brief run fn(first, last, acc) over [start, end) split into at most n_threads chunks of at
+     * least parallel_grain primitives, which run concurrently. The partial results are combined
+     * with merge(acc, part) in chunk order
+     */
+    template <typename T, typename F, typename M>
+    static T parallel_reduce(size_t start, size_t end, int n_threads, const T &identity, F &&fn, M &&merge)
+    {
+        size_t n_chunks = std::min<size_t>(n_threads, (end - start) / parallel_grain);
+        if (n_chunks <= 1)
+        {
+            T result = identity;
+            fn(start, end, result);
+            return result;
+        }
+        size_t step = (end - start + n_chunks - 1) / n_chunks;
+        vector<T> parts(n_chunks, identity);
+        vector<std::future<void>> tasks;
+        for (size_t c = 1; c < n_chunks; c++)
+            tasks.push_back(std::async(std::launch::async, [&, c]
+                                       { fn(start + c * step, std::min(end, start + (c + 1) * step), parts[c]); }));
+        fn(start, start + step, parts[0]);
+        for (auto &task : tasks)
+            task.get();
+        for (size_t c = 1; c < n_chunks; c++)
+            merge(parts[0], parts[c]);
+        return parts[0];
+    }
+
+    range_bounds compute_bounds(const vector<build_primitive> &prims, size_t start, size_t end, int n_threads) const
+    {
+        return parallel_reduce(start, end, n_threads, range_bounds(), [&](size_t first, size_t last, range_bounds &acc)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                const auto &b = prims[i].box;
+                auto c = b.centroid();
+                acc.box = aabb(acc.box, b);
+                acc.centroids = aabb(acc.centroids, aabb(c, c));
+            }
+        },
+        [](range_bounds &acc, const range_bounds &part)
+        {
+            acc.box = aabb(acc.box, part.box);
+            acc.centroids = aabb(acc.centroids, part.centroids);
+        });
+    }
+
+    /**
+     * @brief find the cheapest binned SAH split of prims[start, end). The primitives are binned
+     * along all three axes in a single pass
+     * @return false if making a leaf is cheaper than every split or the centroids coincide
+     */
+    bool find_sah_split(const vector<build_primitive> &prims, size_t start, size_t end, const range_bounds &range,
+                        const bvh_build_options &options, int n_threads, int &best_axis, int &best_bin) const
+    {
+        const int n_bins = bin_count(options, end - start);
+        const auto &centroids = range.centroids;
+        auto bins = parallel_reduce(start, end, n_threads, vector<bin>(3 * n_bins), [&](size_t first, size_t last, vector<bin> &acc)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                const auto &b = prims[i].box;
+                auto c = b.centroid();
+                for (int ax = 0; ax < 3; ax++)
+                {
+                    if (centroids.axis(ax).size() <= 0)
+                        continue;
+                    auto &slot = acc[ax * n_bins + bin_index(c, centroids, ax, n_bins)];
+                    slot.box = aabb(slot.box, b);
+                    slot.count++;
+                }
+            }
+        },
+        [](vector<bin> &acc, const vector<bin> &part)
+        {
+            for (size_t k = 0; k < acc.size(); k++)
+            {
+                acc[k].box = aabb(acc[k].box, part[k].box);
+                acc[k].count += part[k].count;
+            }
+        });
+
+        const size_t span = end - start;
+        double best_cost = options.intersection_cost * span;
+        bool found = false;
+        vector<double> right_area(n_bins);
+        vector<size_t> right_count(n_bins);
+        for (int ax = 0; ax < 3; ax++)
+        {
+            if (centroids.axis(ax).size() <= 0)
+                continue;
+            const bin *axis_bins = &bins[ax * n_bins];
+
+            // sweep from the right, then evaluate every plane while sweeping from the left
+            aabb acc;
+            size_t count = 0;
+            for (int k = n_bins - 1; k > 0; k--)
+            {
+                acc = aabb(acc, axis_bins[k].box);
+                count += axis_bins[k].count;
+                right_area[k] = count ? acc.surface_area() : 0;
+                right_count[k] = count;
+            }
+            acc = aabb();
+            count = 0;
+            for (int k = 1; k < n_bins; k++)
+            {
+                acc = aabb(acc, axis_bins[k - 1].box);
+                count += axis_bins[k - 1].count;
+                if (count == 0 || right_count[k] == 0)
+                    continue;
+                auto cost = options.traversal_cost +
+                            options.intersection_cost * (acc.surface_area() * count + right_area[k] * right_count[k]) /
+                                range.box.surface_area();
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = ax;
+                    best_bin = k;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    static int ceil_log2(size_t n)
+    {
+        int k = 0;
+        while ((size_t(1) << k) < n)
+            k++;
+        return k;
+    }
+
+    // small ranges have fewer distinct split candidates than bins
+    static int bin_count(const bvh_build_options &options, size_t span)
+    {
+        return static_cast<int>(std::min<size_t>(options.n_bins, std::max<size_t>(span, 2)));
+    }
+
+    static int bin_index(const point3 &c, const aabb &centroids, int ax, int n_bins)
+    {
+        auto b = static_cast<int>(n_bins * (c[ax] - centroids.axis(ax).min) / centroids.axis(ax).size());
+        return std::clamp(b, 0, n_bins - 1);
+    }
+
+    /**
+     * @brief build the subtree over prims[start, end) into out, returns the index of its root node.
+     * With more than one thread the second child is built concurrently into a separate array that is
+     * appended once both halves are done; subtrees only touch their own range of prims
+     */
+    uint32_t build_recursive(vector<build_primitive> &prims, size_t start, size_t end, int depth,
+                             const bvh_build_options &options, int n_threads, vector<linear_bvh_node> &out)
+    {
+        auto range = compute_bounds(prims, start, end, n_threads);
+        auto index = make_node(out, range.box);
+
+        size_t span = end - start;
+        size_t mid = start;
+        int ax = 0;
+        // past max_depth_sah, or where an unbalanced SAH split could leave median splits too few
+        // levels, fall back to median splits, which bound the depth below by ceil_log2(span)
+        if (span > 1 && options.split == bvh_split::sah && depth < max_depth_sah &&
+            depth + ceil_log2(span) < max_depth)
+        {
+            int bin = 0;
+            int n_bins = bin_count(options, span);
+            if (find_sah_split(prims, start, end, range, options, n_threads, ax, bin))
+            {
+                auto it = std::partition(prims.begin() + start, prims.begin() + end, [&](const build_primitive &p)
+                                         { return bin_index(p.box.centroid(), range.centroids, ax, n_bins) < bin; });
+                mid = it - prims.begin();
+            }
+            else if (span <= static_cast<size_t>(options.max_leaf_size))
+                mid = end; // a leaf is cheapest
+        }
+        else if (span <= static_cast<size_t>(options.max_leaf_size))
+            mid = end;
+
+        if (mid == end)
+        {
+            out[index].offset = static_cast<uint32_t>(start);
+            out[index].count = static_cast<uint16_t>(span);
+            return index;
+        }
+        if (mid == start)
+        {
+            // median of a pseudo random axis, also used when SAH could not separate the primitives.
+            // The axis is hashed from the range so that the tree does not depend on the thread count
+            ax = options.split == bvh_split::median ? static_cast<int>(mix_bits(start << 32 | end) % 3)
+                                                    : range.box.longest_axis();
+            mid = start + span / 2;
+            std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+                             [&](const build_primitive &a, const build_primitive &b)
+                             { return a.box.axis(ax).min < b.box.axis(ax).min; });
+        }
+
+        uint32_t second;
+        if (n_threads > 1 && span >= 2 * parallel_grain)
+        {
+            vector<linear_bvh_node> right;
+            auto task = std::async(std::launch::async, [&]
+            {
+                right.reserve(2 * (end - mid));
+                build_recursive(prims, mid, end, depth + 1, options, n_threads / 2, right);
+            });
+            build_recursive(prims, start, mid, depth + 1, options, n_threads - n_threads / 2, out);
+            task.get();
+
+            // relocate the child links of the second subtree, leaf offsets already index order
+            second = static_cast<uint32_t>(out.size());
+            for (auto &node : right)
+            {
+                if (!node.is_leaf())
+                    node.offset += second;
+                out.push_back(node);
+            }
+        }
+        else
+        {
+            build_recursive(prims, start, mid, depth + 1, options, n_threads, out);
+            second = build_recursive(prims, mid, end, depth + 1, options, n_threads, out);
+        }
+        out[index].offset = second;
+        out[index].count = 0;
+        out[index].axis = static_cast<uint8_t>(ax);
+        return index;
+    }
+
+    void collect_stats(const vector<linear_bvh_node> &binary, uint32_t index, int depth, double root_area,
+                       bvh_stats &stats, const bvh_build_options &options) const
+    {
+        const auto &node = binary[index];
+        aabb box(point3(node.box_min[0], node.box_min[1], node.box_min[2]),
+                 point3(node.box_max[0], node.box_max[1], node.box_max[2]));
+        auto area = root_area > 0 ? box.surface_area() / root_area : 1.0;
+        stats.nodes++;
+        stats.max_depth = std::max(stats.max_depth, depth);
+        if (node.is_leaf())
+        {
+            stats.leaves++;
+            stats.primitives += node.count;
+            stats.sah_cost += area * options.intersection_cost * node.count;
+            return;
+        }
+        stats.sah_cost += area * options.traversal_cost;
+        collect_stats(binary, index + 1, depth + 1, root_area, stats, options);
+        collect_stats(binary, node.offset, depth + 1, root_area, stats, options);
+    }
+
+    static double node_area(const linear_bvh_node &node)
+    {
+        double dx = node.box_max[0] - node.box_min[0];
+        double dy = node.box_max[1] - node.box_min[1];
+        double dz = node.box_max[2] - node.box_min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    /**
+     * @brief collapse the binary subtree rooted at index into wide nodes, returns the index of its root.
+     * The interior child with the largest surface area is replaced by its two children until the
+     * node is full, so wide nodes end up covering the subtrees rays are most likely to enter
+     */
+    uint32_t collapse(const vector<linear_bvh_node> &binary, uint32_t index)
+    {
+        uint32_t slots[bvh_width];
+        int n = 0;
+        if (binary[index].is_leaf())
+            slots[n++] = index;
+        else
+        {
+            slots[n++] = index + 1;
+            slots[n++] = binary[index].offset;
+            while (n < bvh_width)
+            {
+                int best = -1;
+                double best_area = -1;
+                for (int i = 0; i < n; i++)
+                    if (!binary[slots[i]].is_leaf() && node_area(binary[slots[i]]) > best_area)
+                    {
+                        best = i;
+                        best_area = node_area(binary[slots[i]]);
+                    }
+                if (best < 0)
+                    break;
+                auto opened = slots[best];
+                slots[best] = opened + 1;
+                slots[n++] = binary[opened].offset;
+            }
+        }
+
+        auto w = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes[w].n_children = static_cast<uint8_t>(n);
+        for (int i = 0; i < bvh_width; i++)
+        {
+            // unused slots get an empty box, hit() masks them out anyway
+            const auto *src = i < n ? &binary[slots[i]] : nullptr;
+            for (int a = 0; a < 3; a++)
+            {
+                nodes[w].box_min[a][i] = src ? src->box_min[a] : std::numeric_limits<float>::infinity();
+                nodes[w].box_max[a][i] = src ? src->box_max[a] : -std::numeric_limits<float>::infinity();
+            }
+            nodes[w].child[i] = 0;
+            nodes[w].count[i] = 0;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            const auto &src = binary[slots[i]];
+            if (src.is_leaf())
+            {
+                nodes[w].child[i] = src.offset;
+                nodes[w].count[i] = src.count;
+            }
+            else
+            {
+                auto c = collapse(binary, slots[i]); // may reallocate nodes
+                nodes[w].child[i] = c;
+            }
+        }
+        return w;
+    }
 
 public:
-    bvh_node(const hittable_list& list)
-    : bvh_node(list.get_objects(), 0, list.get_objects().size()) {}
+    bvh_accel() = default;
+    bvh_accel(const vector<aabb> &bounds, const bvh_build_options &options = {})
+    {
+        build(bounds, options);
+    }
+
+    void build(const vector<aabb> &bounds, const bvh_build_options &options = {})
+    {
+        nodes.clear();
+        order.clear();
+        external_nodes = nullptr;
+        external_count = 0;
+        backing.reset();
+        build_stats = bvh_stats();
+        if (bounds.empty())
+            return;
+        vector<build_primitive> prims(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+            prims[i] = {bounds[i], static_cast<uint32_t>(i)};
+        int n_threads = options.n_threads > 0 ? options.n_threads
+                                              : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        vector<linear_bvh_node> binary;
+        binary.reserve(2 * bounds.size());
+        build_recursive(prims, 0, prims.size(), 0, options, n_threads, binary);
+        order.resize(prims.size());
+        for (size_t i = 0; i < prims.size(); i++)
+            order[i] = prims[i].index;
+
+        const auto &root = binary[0];
+        aabb root_box(point3(root.box_min[0], root.box_min[1], root.box_min[2]),
+                      point3(root.box_max[0], root.box_max[1], root.box_max[2]));
+        collect_stats(binary, 0, 0, root_box.surface_area(), build_stats, options);
+
+        nodes.reserve(binary.size() / (bvh_width - 1) + 1);
+        collapse(binary, 0);
+        nodes.shrink_to_fit();
+        build_stats.wide_nodes = nodes.size();
+    }
+
+    // statistics of the binary tree, with the SAH cost evaluated in the cost model of the build options
+    const bvh_stats &stats() const { return build_stats; }
 
-    bvh_node(const std::vector<shared_ptr<hittable>> &src_objects, size_t start, size_t end)
+    /**
+     * @brief use a tree built earlier instead of building one, see snapshot.h
+     * @param data nodes as laid out by build(), read in place
+     * @param backing keeps the memory of data alive
+     */
+    void adopt(const wide_bvh_node *data, size_t count, vector<uint32_t> primitive_order, const bvh_stats &stats,
+               shared_ptr<const void> backing)
     {
-        static auto comp_func = [](const shared_ptr<hittable> a, const shared_ptr<hittable> b, int ax) -> bool
+        nodes.clear();
+        order = std::move(primitive_order);
+        build_stats = stats;
+        external_nodes = data;
+        external_count = count;
+        this->backing = std::move(backing);
+    }
+
+    const vector<uint32_t> &primitive_order() const { return order; }
+    const wide_bvh_node *node_array() const { return external_nodes ? external_nodes : nodes.data(); }
+    size_t node_count() const { return external_nodes ? external_count : nodes.size(); }
+
+    // union of the root's children
+    aabb bounds() const
+    {
+        aabb box;
+        if (node_count() == 0)
+            return box;
+        const auto &root = node_array()[0];
+        for (int i = 0; i < root.n_children; i++)
+            box = aabb(box, aabb(point3(root.box_min[0][i], root.box_min[1][i], root.box_min[2][i]),
+                                 point3(root.box_max[0][i], root.box_max[1][i], root.box_max[2][i])));
+        return box;
+    }
+
+    size_t memory_footprint() const
+    {
+        return node_count() * sizeof(wide_bvh_node) + order.size() * sizeof(uint32_t);
+    }
+
+    /**
+     * @brief front to back traversal with an explicit stack. The children hit are visited in order of
+     * their entry distance, and subtrees entered beyond the shrunk interval are culled when popped.
+     * @param leaf called as leaf(first, count, ray_t) for the primitive range of each leaf reached,
+     * returns whether it hit and shrinks ray_t.max when it does
+     */
+    template <typename F>
+    bool traverse(const ray &r, interval ray_t, F &&leaf) const
+    {
+        if (node_count() == 0)
+            return false;
+        const auto *tree = node_array();
+        slab_ray slabs(r);
+        double4 orig[3], inv_dir[3];
+        for (int a = 0; a < 3; a++)
+        {
+            orig[a] = double4(slabs.orig[a]);
+            inv_dir[a] = double4(slabs.inv_dir[a]);
+        }
+        const int *sign = slabs.sign;
+
+        struct entry
         {
-            return a->bounding_box().axis(ax).min < b->bounding_box().axis(ax).min;
+            uint32_t node;
+            double t;
         };
-        static auto comp_x = std::bind(comp_func, std::placeholders::_1, std::placeholders::_2, 0);
-        static auto comp_y = std::bind(comp_func, std::placeholders::_1, std::placeholders::_2, 1);
-        static auto comp_z = std::bind(comp_func, std::placeholders::_1, std::placeholders::_2, 2);
-        static auto comps = std::vector<decltype(comp_x)>({comp_x, comp_y, comp_z});
-
-        std::vector<shared_ptr<hittable>> objects(src_objects.begin() + start, src_objects.begin() + end);
-        int ax = random_int(0, 2);
-        size_t object_span = end - start;
-        if (object_span == 1)
-            left = right = objects[0];
-        else if (object_span == 2)
-        {
-            if (comps[ax](objects[0], objects[1]))
-            {
-                left = objects[0];
-                right = objects[1];
+        entry stack[max_stack];
+        int sp = 0;
+        stack[sp++] = {0, ray_t.min};
+        bool hit_anything = false;
+        while (sp > 0)
+        {
+            auto current = stack[--sp];
+            if (current.t > ray_t.max)
+                continue;
+            const auto &node = tree[current.node];
+            alignas(32) double t_entry[bvh_width];
+            int mask = node.hit(orig, inv_dir, sign, ray_t, t_entry);
+            if (!mask)
+                continue;
+
+            // sort the children hit by entry distance
+            int sorted[bvh_width];
+            int n = 0;
+            for (int i = 0; i < bvh_width; i++)
+                if (mask >> i & 1)
+                {
+                    int k = n++;
+                    for (; k > 0 && t_entry[sorted[k - 1]] > t_entry[i]; k--)
+                        sorted[k] = sorted[k - 1];
+                    sorted[k] = i;
+                }
+            // interior children far to near onto the stack, so the nearest is popped first
+            for (int k = n - 1; k >= 0; k--)
+                if (!node.is_leaf(sorted[k]))
+                    stack[sp++] = {node.child[sorted[k]], t_entry[sorted[k]]};
+            for (int k = 0; k < n; k++)
+            {
+                int i = sorted[k];
+                if (node.is_leaf(i) && t_entry[i] <= ray_t.max && leaf(node.child[i], node.count[i], ray_t))
+                    hit_anything = true;
             }
-            else
+        }
+        return hit_anything;
+    }
+
+    /**
+     * @brief any hit traversal for occlusion queries, stops at the first leaf that reports a hit.
+     * Children are not ordered since any intersection ends the search
+     * @param leaf called as leaf(first, count) for the primitive range of each leaf reached
+     */
+    template <typename F>
+    bool traverse_any(const ray &r, interval ray_t, F &&leaf) const
+    {
+        if (node_count() == 0)
+            return false;
+        const auto *tree = node_array();
+        slab_ray slabs(r);
+        double4 orig[3], inv_dir[3];
+        for (int a = 0; a < 3; a++)
+        {
+            orig[a] = double4(slabs.orig[a]);
+            inv_dir[a] = double4(slabs.inv_dir[a]);
+        }
+        const int *sign = slabs.sign;
+
+        uint32_t stack[max_stack];
+        int sp = 0;
+        stack[sp++] = 0;
+        while (sp > 0)
+        {
+            const auto &node = tree[stack[--sp]];
+            alignas(32) double t_entry[bvh_width];
+            int mask = node.hit(orig, inv_dir, sign, ray_t, t_entry);
+            for (int i = 0; i < bvh_width; i++)
             {
-                left = objects[1];
-                right = objects[0];
+                if (!(mask >> i & 1))
+                    continue;
+                if (!node.is_leaf(i))
+                    stack[sp++] = node.child[i];
+                else if (leaf(node.child[i], node.count[i]))
+                    return true;
             }
         }
-        else
+        return false;
+    }
+
+    /**
+     * @brief packet version of traverse(), a child is entered while any lane of the mask overlaps it.
+     * Interior children are ordered by the entry distance of the first active lane.
+     * @param leaf called as leaf(first, count, mask) and returns the mask of lanes that hit
+     */
+    template <typename F>
+    int traverse_packet(const ray_packet &rays, int mask, double t_min, const double *t_max, F &&leaf) const
+    {
+        // every entry needs an active lane, children are only pushed with one
+        if (node_count() == 0 || mask == 0)
+            return 0;
+        const auto *tree = node_array();
+        struct entry
         {
-            std::sort(objects.begin(), objects.begin() + object_span, comps[ax]);
-            auto mid = object_span / 2;
-            left = make_shared<bvh_node>(objects, 0, mid);
-            right = make_shared<bvh_node>(objects, mid, object_span);
+            uint32_t node;
+            int mask;
+        };
+        entry stack[max_stack];
+        int sp = 0;
+        stack[sp++] = {0, mask};
+        int hits = 0;
+        while (sp > 0)
+        {
+            auto current = stack[--sp];
+            const auto &node = tree[current.node];
+            int lane = 0;
+            while (!(current.mask >> lane & 1))
+                lane++;
+
+            int active[bvh_width];
+            double t_entry[bvh_width];
+            int sorted[bvh_width];
+            int n = 0;
+            for (int i = 0; i < node.n_children; i++)
+            {
+                alignas(32) double lanes_t[packet_size];
+                active[i] = current.mask & node.hit_packet(i, rays, t_min, t_max, lanes_t);
+                if (!active[i])
+                    continue;
+                if (node.is_leaf(i))
+                {
+                    hits |= leaf(node.child[i], node.count[i], active[i]);
+                    continue;
+                }
+                t_entry[i] = lanes_t[lane];
+                int k = n++;
+                for (; k > 0 && t_entry[sorted[k - 1]] > t_entry[i]; k--)
+                    sorted[k] = sorted[k - 1];
+                sorted[k] = i;
+            }
+            for (int k = n - 1; k >= 0; k--)
+                stack[sp++] = {node.child[sorted[k]], active[sorted[k]]};
         }
-        bbox = aabb(left->bounding_box(), right->bounding_box());
+        return hits;
     }
+};
 
-    bool hit(const ray &ray, interval ray_t, hit_record &rec) const
+/**
+ * @brief BVH over the objects of a hittable_list, stored as a flat node array
+ */
+class bvh : public hittable
+{
+private:
+    bvh_accel accel;
+    bvh_build_options options;
+    primitive_array primitives; // in leaf order
+    aabb bbox;
+    double build_ms = 0;
+
+    // the objects in leaf order
+    void gather(const hittable_list &list)
+    {
+        const auto &src = list.get_objects();
+        primitives.reserve(src.size());
+        for (auto i : accel.primitive_order())
+            primitives.add(src[i]);
+        bbox = list.bounding_box();
+    }
+
+public:
+    bvh(const hittable_list &list, const bvh_build_options &options = {})
+        : options(options)
+    {
+        auto start = std::chrono::steady_clock::now();
+        const auto &src = list.get_objects();
+        vector<aabb> bounds;
+        bounds.reserve(src.size());
+        for (const auto &object : src)
+            bounds.push_back(object->bounding_box());
+        accel.build(bounds, options);
+        gather(list);
+        build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // over a tree built earlier for the same list, e.g. one read from a snapshot
+    bvh(const hittable_list &list, bvh_accel prebuilt)
+        : accel(std::move(prebuilt))
+    {
+        gather(list);
+    }
+
+    const bvh_accel &accelerator() const { return accel; }
+    const primitive_array &primitive_storage() const { return primitives; }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        return accel.traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval &ray_t)
+        {
+            bool hit_anything = false;
+            for (auto i = first; i < first + count; i++)
+                if (primitives.visit(i, [&](const auto &object) { return object.hit(r, ray_t, rec); }))
+                {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            return hit_anything;
+        });
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
     {
-        if (!bbox.hit(ray, ray_t))
+        return accel.traverse_any(r, ray_t, [&](uint32_t first, uint32_t count)
+        {
+            for (auto i = first; i < first + count; i++)
+                if (primitives.visit(i, [&](const auto &object) { return object.occluded(r, ray_t); }))
+                    return true;
             return false;
-        bool hit_left = left->hit(ray, ray_t, rec);
-        bool hit_right = right->hit(ray, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        });
+    }
 
-        return hit_left || hit_right;
+    int hit_packet(const ray_packet &rays, int mask, double t_min, double *t_max, hit_record *recs) const override
+    {
+        return accel.traverse_packet(rays, mask, t_min, t_max, [&](uint32_t first, uint32_t count, int active)
+        {
+            int hits = 0;
+            for (auto i = first; i < first + count; i++)
+                hits |= primitives.visit(i, [&](const auto &object) { return object.hit_packet(rays, active, t_min, t_max, recs); });
+            return hits;
+        });
     }
 
-    aabb bounding_box() const
+    aabb bounding_box() const override
     {
         return bbox;
     }
-};
 
-using bvh = bvh_node;
\ No newline at end of file
+    size_t memory_footprint() const
+    {
+        return sizeof(*this) + accel.memory_footprint() + primitives.memory_footprint();
+    }
+
+    void report(std::ostream &out) const
+    {
+        const auto &stats = accel.stats();
+        out << "BVH (" << (options.split == bvh_split::sah ? "SAH" : "median") << "): "
+            << primitives.size() << " primitives (" << primitives.sphere_count() << " spheres, "
+            << primitives.quad_count() << " quads, " << primitives.other_count() << " other), " << stats.nodes << " nodes (" << stats.wide_nodes << " "
+            << bvh_width << "-wide), " << stats.leaves << " leaves ("
+            << static_cast<double>(stats.primitives) / stats.leaves << " primitives/leaf), depth " << stats.max_depth
+            << ", SAH cost " << stats.sah_cost << ", " << memory_footprint() / 1024.0 << " KiB, built in " << build_ms << " ms" << std::endl;
+    }
+};
\ No newline at end of file
@@ -5,13 +5,22 @@
 #include "utils.h"
 #include "hittable.h"
 #include "material.h"
+#include "lights.h"
 #include "indicators.h"
+#include "scheduler.h"
+#include "film.h"
+#include "ray_packet.h"
 
+#include <algorithm>
+#include <atomic>
+#include <string>
 #include <thread>
 #include <vector>
 
 class camera
 {
+    friend class wavefront_integrator;
+
 public:
     /* Public Camera Parameters Here */
     double aspect_ratio = 1.0;
@@ -19,7 +28,18 @@ public:
     int image_height;        // will be calculated in initialize()
     int samples_per_row = 2; // stratified sampling
     int samples_per_subpixel = 1;
-    int max_depth = 10;
+    int max_depth = 10;      // safety limit, paths normally end by russian roulette
+    int rr_min_depth = 3;    // bounces before russian roulette may end a path
+    bool use_packets = true; // intersect primary rays as SIMD packets
+    bool sample_lights = true; // next event estimation at diffuse hits, see light_list
+    bool light_tree = true;    // pick the light to sample by the light tree, uniformly otherwise
+    int tile_size = 16;      // edge length of the square tiles handed to workers
+    int checkpoint_interval = 8; // passes between two checkpoints in render_progressive()
+    // adaptive sampling in render_progressive(), a pixel stops once the 95% confidence interval of
+    // its gamma corrected luminance is narrower than +-adaptive_threshold. 0 disables it
+    double adaptive_threshold = 0;
+    int adaptive_min_samples = 16;
+    int adaptive_max_samples = 0; // cap for noisy pixels, 0 means 8 * samples_per_pixel()
     double vfov = 90;
     point3 lookat = point3(0, 0, -1);
     point3 lookfrom = point3(0, 0, 0);
@@ -37,98 +57,175 @@ public:
         if (n_workers == 0)
             n_workers = max_workers;
         clog << "Using " << n_workers << " workers" << endl;
-        // Single Thread Rendering
-        if (n_workers == 1)
+        auto lights = collect_lights(world);
+
+        auto tiles = make_tiles(image_width, image_height, tile_size);
+        const uint32_t n_tiles = tiles.size();
+
+        auto render_tile = [&](const tile &t)
         {
-            for (int y = 0; y < image_height; ++y)
-            {
-                clog << "\rRemaining scanlines: " << (image_height - y) << " " << flush;
-                for (int x = 0; x < image_width; ++x)
-                {
-                    auto pixel_color = color(0, 0, 0);
-                    for (int j = 0; j < samples_per_row; j++)
-                        for (int i = 0; i < samples_per_row; i++)
-                        {
-                            auto subpixel_color = color(0, 0, 0);
-                            for (int k = 0; k < samples_per_subpixel; k++)
-                            {
-                                ray ray = get_ray(x, y, i, j);
-                                subpixel_color += ray_color(ray, max_depth, world);
-                            }
-                            subpixel_color /= samples_per_subpixel;
-                            pixel_color += subpixel_color;
-                        }
-                    pixel_color /= (samples_per_row * samples_per_row);
-                    write_color(image, x, y, pixel_color);
-                }
-            }
+            for (int y = t.y0; y < t.y1; ++y)
+                for (int x = t.x0; x < t.x1; ++x)
+                    write_color(image, x, y, pixel_color(x, y, world, lights));
+        };
+
+        // a single worker logs the remaining tiles, several share a progress bar
+        using namespace indicators;
+        if (n_workers > 1)
+            show_console_cursor(false);
+        indicators::ProgressBar bar{
+            option::BarWidth{50},
+            option::Start{" ["},
+            option::Fill{""},
+            option::Lead{""},
+            option::Remainder{"-"},
+            option::End{"]"},
+            option::ShowPercentage{true},
+            option::PrefixText{"Rendering"},
+            option::ForegroundColor{Color::yellow},
+            option::ShowElapsedTime{true},
+            option::ShowRemainingTime{true},
+            option::FontStyles{std::vector<FontStyle>{FontStyle::bold}}
+        };
+
+        progress = 0;
+        for_each_tile(tiles, n_workers, [&](const tile &t)
+        {
+            if (n_workers == 1)
+                clog << "\rRemaining tiles: " << (n_tiles - progress) << " " << flush;
+            render_tile(t);
+            auto done = ++progress;
+            if (n_workers > 1)
+                bar.set_progress(100 * done / n_tiles);
+        });
+
+        if (n_workers == 1)
             clog << endl;
-        }
-        // Multiple Threads Rendering
         else
+            show_console_cursor(true);
+    }
+
+    /**
+     * @brief render into a float accumulation buffer, one sample per pixel and pass, until every
+     * pixel holds samples_per_pixel() samples or max_passes passes (0 = no limit) were done.
+     * With adaptive sampling the same total budget of samples_per_pixel() samples per pixel is
+     * spent instead, but converged pixels drop out and their share goes to the noisy ones.
+     * With a checkpoint path the buffer is resumed from that file when it exists, and saved to it
+     * every checkpoint_interval passes and when rendering stops. A checkpoint is only resumed by
+     * a render of the same scene with the same settings
+     * @param scene_fingerprint identifies the scene, e.g. a hash of its description
+     */
+    void render_progressive(film &accum, const hittable &world, const std::string &checkpoint = "",
+                            uint64_t scene_fingerprint = 0, int max_passes = 0, int n_workers = 0) const
+    {
+        using namespace std;
+
+        if (n_workers == 0)
+            n_workers = thread::hardware_concurrency();
+        clog << "Using " << n_workers << " workers" << endl;
+        auto fingerprint = settings_fingerprint(world, scene_fingerprint);
+        if (!checkpoint.empty())
         {
-            using namespace indicators;
+            if (accum.load(checkpoint, fingerprint))
+                clog << "Resumed from " << checkpoint << " with " << accum.total_samples() << " samples" << endl;
+            else if (ifstream(checkpoint))
+                clog << "Ignoring " << checkpoint << ", it was written for another scene or other settings" << endl;
+        }
+        auto lights = collect_lights(world);
 
-            // Hide cursor
-            show_console_cursor(false);
+        auto tiles = make_tiles(image_width, image_height, tile_size);
+        const bool adaptive = adaptive_threshold > 0;
+        const uint32_t target = adaptive ? (adaptive_max_samples > 0 ? adaptive_max_samples : 8 * samples_per_pixel())
+                                         : samples_per_pixel();
+        const uint64_t budget = static_cast<uint64_t>(image_width) * image_height * samples_per_pixel();
+        bool dirty = false;
 
-            indicators::ProgressBar bar{
-                option::BarWidth{50},
-                option::Start{" ["},
-                option::Fill{""},
-                option::Lead{""},
-                option::Remainder{"-"},
-                option::End{"]"},
-                option::ShowPercentage{true},
-                option::PrefixText{"Rendering"},
-                option::ForegroundColor{Color::yellow},
-                option::ShowElapsedTime{true},
-                option::ShowRemainingTime{true},
-                option::FontStyles{std::vector<FontStyle>{FontStyle::bold}}
-            };
-
-            auto worker = [&](int id)
-            {
-                int y = 0, x = id, n_pixels = image_height * image_width;
-                while (y < image_height)
+        // display space half width of the 95% confidence interval, pooled over the 3x3
+        // neighbourhood so that a pixel whose few samples happened to agree does not stop early
+        vector<double> error(image_width * image_height);
+        vector<uint8_t> active(image_width * image_height);
+        auto update_active = [&]()
+        {
+            for (int y = 0; y < image_height; y++)
+                for (int x = 0; x < image_width; x++)
+                {
+                    auto mean = fmax(luminance(accum.value(x, y)), 1e-3);
+                    error[y * image_width + x] = 1.96 * accum.standard_error(x, y) / (2 * sqrt(mean));
+                }
+            for (int y = 0; y < image_height; y++)
+                for (int x = 0; x < image_width; x++)
                 {
-                    auto pixel_color = color(0, 0, 0);
-                    for (int j = 0; j < samples_per_row; j++)
-                        for (int i = 0; i < samples_per_row; i++)
-                        {
-                            auto subpixel_color = color(0, 0, 0);
-                            for (int k = 0; k < samples_per_subpixel; k++)
+                    auto n = accum.samples(x, y);
+                    bool needed = n < target;
+                    if (needed && adaptive && n >= static_cast<uint32_t>(adaptive_min_samples))
+                    {
+                        double pooled = 0;
+                        for (int dy = -1; dy <= 1; dy++)
+                            for (int dx = -1; dx <= 1; dx++)
                             {
-                                ray ray = get_ray(x, y, i, j);
-                                subpixel_color += ray_color(ray, max_depth, world);
+                                int nx = std::clamp(x + dx, 0, image_width - 1);
+                                int ny = std::clamp(y + dy, 0, image_height - 1);
+                                pooled = fmax(pooled, error[ny * image_width + nx]);
                             }
-                            subpixel_color /= samples_per_subpixel;
-                            pixel_color += subpixel_color;
-                        }
-                    pixel_color /= (samples_per_row * samples_per_row);
-                    write_color(image, x, y, pixel_color);
-                    progress++;
-                    if (progress * 100 % n_pixels == 0)
-                        bar.tick();
-                    x += n_workers;
-                    if (x >= image_width)
-                    {
-                        x -= image_width;
-                        y++;
+                        needed = pooled > adaptive_threshold;
                     }
+                    active[y * image_width + x] = needed;
                 }
-            };
+        };
 
-            progress = 0;
-            vector<thread> threads;
-            for (int i = 0; i < n_workers; i++)
-                threads.push_back(thread(worker, i));
-            for (auto &t : threads)
-                t.join();
+        for (int pass = 0; max_passes == 0 || pass < max_passes; pass++)
+        {
+            update_active();
+            atomic_bool rendered(false);
+            for_each_tile(tiles, n_workers, [&](const tile &t)
+            {
+                // neighbouring active pixels of a row are traced as one packet
+                sample_id batch[packet_size];
+                color colors[packet_size];
+                int count = 0;
+                auto flush_batch = [&]()
+                {
+                    trace_samples(batch, count, world, lights, colors);
+                    for (int l = 0; l < count; l++)
+                        accum.add_sample(batch[l].x, batch[l].y, colors[l]);
+                    count = 0;
+                    rendered = true;
+                };
+                for (int y = t.y0; y < t.y1; ++y)
+                {
+                    for (int x = t.x0; x < t.x1; ++x)
+                    {
+                        if (!active[y * image_width + x])
+                            continue;
+                        batch[count++] = {x, y, accum.samples(x, y)};
+                        if (count == packet_size)
+                            flush_batch();
+                    }
+                    if (count)
+                        flush_batch();
+                }
+            });
+            if (!rendered)
+                break;
+            dirty = true;
+            clog << "\rPass " << pass + 1 << ", " << accum.total_samples() << " samples " << flush;
 
-            // Show cursor
-            show_console_cursor(true);
+            if (!checkpoint.empty() && (pass + 1) % checkpoint_interval == 0)
+            {
+                accum.save(checkpoint, fingerprint);
+                dirty = false;
+            }
+            if (adaptive && accum.total_samples() >= budget)
+                break;
         }
+        clog << endl;
+        if (!checkpoint.empty() && dirty)
+            accum.save(checkpoint, fingerprint);
+    }
+
+    int samples_per_pixel() const
+    {
+        return samples_per_row * samples_per_row * samples_per_subpixel;
     }
 
     void initialize()
@@ -182,6 +279,34 @@ private:
     vec3 u, v, w; // right, up, opposite view direction
     vec3 defocus_disk_u, defocus_disk_v;
 
+    struct sample_id
+    {
+        int x, y;
+        uint32_t n; // sample index inside the pixel
+    };
+
+    /**
+     * @brief hash of everything a checkpoint of world depends on: the settings that change the
+     * samples, the seed, the bounds of world and the fingerprint of its scene. tile_size,
+     * use_packets and checkpoint_interval only change the schedule and are left out
+     */
+    uint64_t settings_fingerprint(const hittable &world, uint64_t scene_fingerprint) const
+    {
+        auto h = hash_bytes(&scene_fingerprint, sizeof(scene_fingerprint));
+        auto add = [&h](const auto &value) { h = hash_bytes(&value, sizeof(value), h); };
+        auto add_vec = [&add](const vec3 &v) { add(v.x()), add(v.y()), add(v.z()); };
+        add(render_seed());
+        add(image_width), add(image_height), add(samples_per_row), add(samples_per_subpixel);
+        add(max_depth), add(rr_min_depth), add(sample_lights), add(light_tree);
+        add(adaptive_threshold), add(adaptive_min_samples), add(adaptive_max_samples);
+        add(vfov), add(defocus_angle), add(focus_dist);
+        add_vec(lookat), add_vec(lookfrom), add_vec(vup), add_vec(background);
+        auto box = world.bounding_box();
+        for (int a = 0; a < 3; a++)
+            add(box.axis(a).min), add(box.axis(a).max);
+        return h;
+    }
+
     /**
      * @brief get jittered samples using stratified sampling
      * @param i x position of sub pixel
@@ -202,28 +327,177 @@ private:
         return ray(ray_origin, ray_direction, ray_time);
     }
 
+    /**
+     * @brief trace the n-th sample of pixel (x, y). Consecutive samples cycle through the
+     * samples_per_row x samples_per_row strata, so any prefix of samples is well stratified
+     */
+    color sample_color(int x, int y, uint32_t n, const hittable &world, const light_list &lights) const
+    {
+        int stratum = n % (samples_per_row * samples_per_row);
+        seed_sample(static_cast<uint64_t>(y) * image_width + x, n);
+        ray ray = get_ray(x, y, stratum % samples_per_row, stratum / samples_per_row);
+        return ray_color(ray, world, lights);
+    }
+
+    /**
+     * @brief trace up to packet_size samples. Their primary rays are intersected together as one
+     * packet, then every lane continues on its own since secondary rays are incoherent
+     */
+    void trace_samples(const sample_id *ids, int count, const hittable &world, const light_list &lights,
+                       color *out) const
+    {
+        if (!use_packets || count == 1)
+        {
+            for (int l = 0; l < count; l++)
+                out[l] = sample_color(ids[l].x, ids[l].y, ids[l].n, world, lights);
+            return;
+        }
+
+        ray_packet packet;
+        pcg32 rngs[packet_size];
+        for (int l = 0; l < count; l++)
+        {
+            int stratum = ids[l].n % (samples_per_row * samples_per_row);
+            seed_sample(static_cast<uint64_t>(ids[l].y) * image_width + ids[l].x, ids[l].n);
+            packet.set(l, get_ray(ids[l].x, ids[l].y, stratum % samples_per_row, stratum / samples_per_row));
+            rngs[l] = thread_rng();
+        }
+        for (int l = count; l < packet_size; l++)
+            packet.set(l, packet.rays[0]);
+
+        double t_max[packet_size];
+        std::fill_n(t_max, packet_size, inf);
+        hit_record recs[packet_size];
+        pcg32 packet_rng = rngs[0];
+        thread_rng() = packet_rng.split(); // for media sampled during the packet traversal
+        int hits = world.hit_packet(packet, (1 << count) - 1, 0.001, t_max, recs);
+
+        for (int l = 0; l < count; l++)
+        {
+            thread_rng() = rngs[l];
+            out[l] = ray_color(packet.rays[l], (hits >> l & 1) ? &recs[l] : nullptr, world, lights);
+        }
+    }
+
+    // average of all stratified samples of pixel (x, y)
+    color pixel_color(int x, int y, const hittable &world, const light_list &lights) const
+    {
+        auto pixel_sum = color(0, 0, 0);
+        int n_samples = samples_per_pixel();
+        for (int n = 0; n < n_samples; n += packet_size)
+        {
+            sample_id ids[packet_size];
+            color colors[packet_size];
+            int count = std::min(packet_size, n_samples - n);
+            for (int l = 0; l < count; l++)
+                ids[l] = {x, y, static_cast<uint32_t>(n + l)};
+            trace_samples(ids, count, world, lights, colors);
+            for (int l = 0; l < count; l++)
+                pixel_sum += colors[l];
+        }
+        return pixel_sum / n_samples;
+    }
+
+    // run fn on every tile, spread over n_workers threads
+    template <typename F>
+    void for_each_tile(const std::vector<tile> &tiles, int n_workers, F &&fn) const
+    {
+        tile_scheduler scheduler(tiles, n_workers);
+        auto worker = [&](int id)
+        {
+            tile t;
+            while (scheduler.next(id, t))
+                fn(t);
+        };
+        if (n_workers == 1)
+        {
+            worker(0);
+            return;
+        }
+        std::vector<std::thread> threads;
+        for (int i = 0; i < n_workers; i++)
+            threads.push_back(std::thread(worker, i));
+        for (auto &t : threads)
+            t.join();
+    }
+
     point3 defocus_disk_sample() const
     {
         auto p = random_in_unit_disk();
         return center + defocus_disk_u * p.x() + defocus_disk_v * p.y();
     }
 
-    color ray_color(const ray &r, int depth, const hittable &world) const
+    // the lights to sample, none when sample_lights is off
+    light_list collect_lights(const hittable &world) const
     {
-        if (depth <= 0)
-            return color(0, 0, 0);
+        if (!sample_lights)
+            return light_list();
+        light_list lights(world, light_tree);
+        std::clog << "Sampling " << lights.size() << " lights" << (light_tree ? "" : " uniformly") << std::endl;
+        return lights;
+    }
+
+    /**
+     * @brief iterative path tracer. The throughput carries the product of attenuations along the
+     * path; after rr_min_depth bounces paths are terminated by russian roulette with a survival
+     * probability equal to their throughput, so max_depth is only a safety limit.
+     * At diffuse hits one light is sampled directly, and emission found by scattering is weighted
+     * against it by multiple importance sampling
+     */
+    color ray_color(const ray &r, const hittable &world, const light_list &lights) const
+    {
+        hit_record rec;
+        bool hit = world.hit(r, interval(0.001, inf), rec);
+        return ray_color(r, hit ? &rec : nullptr, world, lights);
+    }
+
+    // continue a path whose first intersection is already known, primary is nullptr on a miss
+    color ray_color(ray r, const hit_record *primary, const hittable &world, const light_list &lights) const
+    {
+        color radiance(0, 0, 0);
+        color throughput(1, 1, 1);
+        double scatter_pdf = 0; // density of the last bounce, 0 if lights were not sampled there
+        vec3 scatter_normal;    // normal lights were picked with at the last bounce
         hit_record rec;
-        if (world.hit(r, interval(0.001, inf), rec))
+        if (primary)
+            rec = *primary;
+        for (int depth = 0; depth < max_depth; depth++)
         {
+            bool hit = depth == 0 ? primary != nullptr : world.hit(r, interval(0.001, inf), rec);
+            if (!hit)
+            {
+                radiance += throughput * background;
+                break;
+            }
+            int light = scatter_pdf > 0 ? lights.find(rec) : -1;
+            rec.complete(r);
+
             ray scattered;
             color attenuation;
-            color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+            if (rec.mat->is_emitting())
+            {
+                auto weight = light < 0 ? 1 : power_heuristic(scatter_pdf, lights.pdf(light, r, scatter_normal, rec));
+                radiance += throughput * weight * rec.mat->emitted(rec.u, rec.v, rec.p);
+            }
+            bool sampled = !lights.empty() && rec.mat->is_diffuse();
+            if (sampled)
+                radiance += throughput * lights.sample_direct(r, rec, world);
+            if (!rec.mat->scattered(r, rec, attenuation, scattered))
+                break;
+            throughput = throughput * attenuation;
+            scatter_pdf = sampled ? rec.mat->scattering_pdf(r, rec, scattered.direction()) : 0;
+            if (sampled)
+                scatter_normal = light_list::selection_normal(r, rec);
 
-            if (rec.mat->scattered(r, rec, attenuation, scattered))
-                return color_from_emission + attenuation * ray_color(scattered, depth - 1, world);
-            else
-                return color_from_emission;
+            if (depth >= rr_min_depth)
+            {
+                auto survival = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), 0.95);
+                if (random_double() >= survival)
+                    break;
+                throughput /= survival;
+            }
+            r = scattered;
         }
-        return background;
+        return radiance;
     }
 };
\ No newline at end of file
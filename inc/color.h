@@ -6,6 +6,11 @@
 
 using color = vec3;
 
+inline double luminance(const color &c)
+{
+    return 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+}
+
 inline double linear_to_gamma(double linear_component)
 {
     return sqrt(linear_component);
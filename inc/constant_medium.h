@@ -52,7 +52,8 @@ public:
 
         rec.normal = random_unit_vector();
         rec.front_face = true;
-        rec.mat = phase_function;
+        rec.mat = phase_function.get();
+        rec.object = nullptr;
         return true;
     }
 
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "CImg.h"
+#include "utils.h"
+#include "file_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+/**
+ * @brief floating point accumulation buffer for progressive rendering.
+ * Keeps the running sum of radiance, the sum of squared luminance (for variance estimates)
+ * and the sample count of every pixel, and can be checkpointed to / resumed from disk
+ */
+class film
+{
+private:
+    static constexpr char magic[8] = {'R', 'T', 'F', 'I', 'L', 'M', '0', '2'};
+
+    int width = 0, height = 0;
+    vector<color> sum;
+    vector<double> sum_sq; // of luminance
+    vector<uint32_t> count;
+
+public:
+    film() = default;
+    film(int width, int height)
+        : width(width), height(height), sum(width * height), sum_sq(width * height, 0.0), count(width * height, 0) {}
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    void add_sample(int x, int y, const color &c)
+    {
+        auto idx = y * width + x;
+        auto l = luminance(c);
+        sum[idx] += c;
+        sum_sq[idx] += l * l;
+        count[idx]++;
+    }
+
+    uint32_t samples(int x, int y) const
+    {
+        return count[y * width + x];
+    }
+
+    uint64_t total_samples() const
+    {
+        uint64_t total = 0;
+        for (auto n : count)
+            total += n;
+        return total;
+    }
+
+    // mean radiance of the pixel
+    color value(int x, int y) const
+    {
+        auto idx = y * width + x;
+        return count[idx] ? sum[idx] / count[idx] : color(0, 0, 0);
+    }
+
+    /**
+     * @brief standard error of the pixel's mean luminance, estimated from the sample variance
+     */
+    double standard_error(int x, int y) const
+    {
+        auto idx = y * width + x;
+        auto n = count[idx];
+        if (n < 2)
+            return inf;
+        auto mean = luminance(sum[idx]) / n;
+        auto variance = (sum_sq[idx] - n * mean * mean) / (n - 1);
+        return sqrt(fmax(variance, 0.0) / n);
+    }
+
+    void resolve(cimg_library::CImg<unsigned char> &image) const
+    {
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                write_color(image, x, y, value(x, y));
+    }
+
+    /**
+     * @brief write the buffer to path. The data goes to a temporary file first which is then
+     * renamed, so an interrupted write never destroys the previous checkpoint
+     * @param fingerprint of the scene and settings the samples were rendered with, see load()
+     */
+    bool save(const std::string &path, uint64_t fingerprint) const
+    {
+        auto tmp_path = path + ".tmp";
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+            int32_t size[2] = {width, height};
+            out.write(magic, sizeof(magic));
+            out.write(reinterpret_cast<const char *>(size), sizeof(size));
+            out.write(reinterpret_cast<const char *>(&fingerprint), sizeof(fingerprint));
+            out.write(reinterpret_cast<const char *>(sum.data()), sum.size() * sizeof(color));
+            out.write(reinterpret_cast<const char *>(sum_sq.data()), sum_sq.size() * sizeof(double));
+            out.write(reinterpret_cast<const char *>(count.data()), count.size() * sizeof(uint32_t));
+            if (!out)
+                return false;
+        }
+        return replace_file(tmp_path, path);
+    }
+
+    /**
+     * @brief restore the buffer from a checkpoint written by save()
+     * @return false if the file is missing, truncated, of another resolution or written with
+     * another fingerprint
+     */
+    bool load(const std::string &path, uint64_t fingerprint)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        char header[sizeof(magic)];
+        int32_t size[2];
+        uint64_t saved_fingerprint;
+        in.read(header, sizeof(header));
+        in.read(reinterpret_cast<char *>(size), sizeof(size));
+        in.read(reinterpret_cast<char *>(&saved_fingerprint), sizeof(saved_fingerprint));
+        if (!in || !std::equal(header, header + sizeof(magic), magic) || size[0] != width || size[1] != height ||
+            saved_fingerprint != fingerprint)
+            return false;
+
+        vector<color> new_sum(sum.size());
+        vector<double> new_sum_sq(sum_sq.size());
+        vector<uint32_t> new_count(count.size());
+        in.read(reinterpret_cast<char *>(new_sum.data()), new_sum.size() * sizeof(color));
+        in.read(reinterpret_cast<char *>(new_sum_sq.data()), new_sum_sq.size() * sizeof(double));
+        in.read(reinterpret_cast<char *>(new_count.data()), new_count.size() * sizeof(uint32_t));
+        if (!in)
+            return false;
+        sum = std::move(new_sum);
+        sum_sq = std::move(new_sum_sq);
+        count = std::move(new_count);
+        return true;
+    }
+};
\ No newline at end of file
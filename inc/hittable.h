@@ -4,17 +4,29 @@
 #include "aabb.h"
 
 class material;
+class hittable;
 
+/**
+ * @brief intersection data. During traversal primitives only record t, the material and
+ * themselves as the pending object; complete() then computes the surface (point, normal, UVs)
+ * once for the closest hit
+ */
 class hit_record
 {
 public:
     point3 p;
     vec3 normal; // must be unit vector
-    shared_ptr<material> mat;
+    const material *mat = nullptr; // not owning, the hit object keeps the material alive
+    const hittable *object = nullptr; // primitive whose surface data is still to be computed
+    const hittable *instanced = nullptr; // when object is an instance: the pending object inside it
+    uint32_t primitive = 0; // which part of the pending object was hit, for objects made of many (meshes)
     double t;
     bool front_face;
     double u, v; // texture coordinates
 
+    // compute the surface of the pending object, r must be the ray that was passed to its hit()
+    void complete(const ray &r);
+
     /**
      * @param outward_normal must be a unit vector
      */
@@ -31,119 +43,50 @@ public:
     virtual ~hittable() = default;
     virtual bool hit(const ray &ray, interval ray_t, hit_record &rec) const = 0;
     virtual aabb bounding_box() const = 0;
-    virtual point3 sample() const
-    {
-        return point3(0, 0, 0);
-    }
-};
-
-class translate : public hittable
-{
-private:
-    shared_ptr<hittable> object;
-    vec3 offset;
-    aabb bbox;
 
-public:
-    translate(shared_ptr<hittable> p, const vec3 &displacement)
-        : object(p), offset(displacement)
-    {
-        bbox = object->bounding_box() + offset;
-    }
-
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
-    {
-        ray offset_ray(r.origin() - offset, r.direction(), r.time());
-
-        if (!object->hit(offset_ray, ray_t, rec))
-            return false;
-
-        rec.p += offset;
-        return true;
-    }
-
-    aabb bounding_box() const override
+    /**
+     * @brief any hit query for shadow and visibility rays: whether something intersects the ray
+     * within ray_t. Overrides return on the first intersection found and skip the hit record,
+     * the default falls back to a closest hit query
+     */
+    virtual bool occluded(const ray &ray, interval ray_t) const
     {
-        return bbox;
+        hit_record rec;
+        return hit(ray, ray_t, rec);
     }
-};
 
-class rotate_y : public hittable
-{
-private:
-    shared_ptr<hittable> object;
-    aabb bbox;
-    double sin_theta;
-    double cos_theta;
-
-public:
-    rotate_y(shared_ptr<hittable> p, double angle) : object(p)
+    /**
+     * @brief closest hit for the lanes of a ray packet, by default the lanes are traced one by one
+     * @param mask lanes to trace
+     * @param t_max per lane upper bound, lowered to the hit distance when a lane hits
+     * @param recs per lane hit records, only written for lanes that hit
+     * @return bit mask of the lanes that hit
+     */
+    virtual int hit_packet(const ray_packet &rays, int mask, double t_min, double *t_max, hit_record *recs) const
     {
-        auto rad = deg_to_rad(angle);
-        sin_theta = sin(rad);
-        cos_theta = cos(rad);
-        bbox = object->bounding_box();
-
-        point3 min(inf, inf, inf);
-        point3 max(-inf, -inf, -inf);
-        for (int i = 0; i <= 1; i++)
-        {
-            auto x = (1 - i) * bbox.x.min + i * bbox.x.max;
-            for (int j = 0; j <= 1; j++)
+        int hits = 0;
+        for (int l = 0; l < packet_size; l++)
+            if ((mask >> l & 1) && hit(rays.rays[l], interval(t_min, t_max[l]), recs[l]))
             {
-                auto y = (1 - j) * bbox.y.min + j * bbox.y.max;
-                for (int k = 0; k <= 1; k++)
-                {
-                    auto z = (1 - k) * bbox.z.min + k * bbox.z.max;
-
-                    auto new_x = cos_theta * x + sin_theta * z;
-                    auto new_z = -sin_theta * x + cos_theta * z;
-
-                    vec3 tester(new_x, y, new_z);
-
-                    for (int ax = 0; ax < 3; ax++)
-                    {
-                        min[ax] = fmin(min[ax], tester[ax]);
-                        max[ax] = fmax(max[ax], tester[ax]);
-                    }
-                }
+                t_max[l] = recs[l].t;
+                hits |= 1 << l;
             }
-        }
-
-        bbox = aabb(min, max);
+        return hits;
     }
 
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
-    {
-        auto origin = r.origin();
-        auto direction = r.direction();
-
-        origin[0] = cos_theta * r.origin().x() - sin_theta * r.origin().z();
-        origin[2] = sin_theta * r.origin().x() + cos_theta * r.origin().z();
-
-        direction[0] = cos_theta * r.direction().x() - sin_theta * r.direction().z();
-        direction[2] = sin_theta * r.direction().x() + cos_theta * r.direction().z();
-
-        ray rotated_r(origin, direction, r.time());
-
-        if (!object->hit(rotated_r, ray_t, rec))
-            return false;
-
-        auto p = rec.p;
-        p[0] = cos_theta * rec.p.x() + sin_theta * rec.p.z();
-        p[2] = -sin_theta * rec.p.x() + cos_theta * rec.p.z();
-        rec.p = p;
-
-        auto normal = rec.normal;
-        normal[0] = cos_theta * rec.normal.x() + sin_theta * rec.normal.z();
-        normal[2] = -sin_theta * rec.normal.x() + cos_theta * rec.normal.z();
-        rec.normal = normal;
-
-        return true;
-    }
+    /**
+     * @brief deferred part of hit(): fill p, normal, front_face and the UVs of a record whose
+     * t was set by this object. Objects that fill the whole record in hit() keep the default
+     * and set rec.object to nullptr, so a farther pending hit is not completed instead
+     */
+    virtual void set_surface(const ray &r, hit_record &rec) const {}
+};
 
-    aabb bounding_box() const override
+inline void hit_record::complete(const ray &r)
+{
+    if (object)
     {
-        return bbox;
+        object->set_surface(r, *this);
+        object = nullptr;
     }
-};
\ No newline at end of file
+}
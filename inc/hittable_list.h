@@ -43,21 +43,34 @@ public:
 
     bool hit(const ray &ray, interval ray_t, hit_record &rec) const override
     {
-        hit_record temp_rec;
+        // objects only write rec when they report a hit, so every closer hit simply overwrites it
         bool hit_anything = false;
         double tmax_so_far = ray_t.max;
 
         for (auto &object : objects)
         {
-            if (object->hit(ray, interval(ray_t.min, tmax_so_far), temp_rec))
+            if (object->hit(ray, interval(ray_t.min, tmax_so_far), rec))
             {
                 hit_anything = true;
-                tmax_so_far = temp_rec.t;
+                tmax_so_far = rec.t;
             }
         }
-
-        if (hit_anything)
-            rec = temp_rec;
         return hit_anything;
     }
+
+    bool occluded(const ray &ray, interval ray_t) const override
+    {
+        for (auto &object : objects)
+            if (object->occluded(ray, ray_t))
+                return true;
+        return false;
+    }
+
+    int hit_packet(const ray_packet &rays, int mask, double t_min, double *t_max, hit_record *recs) const override
+    {
+        int hits = 0;
+        for (auto &object : objects)
+            hits |= object->hit_packet(rays, mask, t_min, t_max, recs);
+        return hits;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "utils.h"
+#include "affine.h"
+#include "hittable.h"
+
+/**
+ * @brief object placed in the world by an affine map. The object is shared, not copied, so
+ * many instances of one bvh form a two level acceleration structure: a bvh over the instances
+ * on top, and the geometry bvh they reference at the bottom.
+ * An instance of an instance is flattened into a single map on construction
+ */
+class instance : public hittable
+{
+private:
+    shared_ptr<hittable> object;
+    affine to_world;
+    affine to_object;
+    aabb bbox;
+
+    // the direction is not normalized, so t is the same in both spaces
+    ray local_ray(const ray &r) const
+    {
+        return ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+    }
+
+    // move the surface of a completed record from object space into the world
+    void place(hit_record &rec) const
+    {
+        rec.p = to_world.point(rec.p);
+        rec.normal = unit(to_object.normal(rec.normal));
+    }
+
+    /**
+     * @brief make this instance the pending object of a record its object just hit, so the surface
+     * is computed and moved by set_surface() only for the closest hit. A record whose pending
+     * object may itself be an instance is completed at once, the record only holds one level
+     * @param pending the record's instanced before the query, which was reset for it
+     */
+    void defer(const ray &local, hit_record &rec, const hittable *pending) const
+    {
+        if (rec.instanced)
+        {
+            rec.complete(local);
+            place(rec);
+            rec.instanced = pending;
+            return;
+        }
+        rec.instanced = rec.object;
+        rec.object = this;
+    }
+
+public:
+    instance(shared_ptr<hittable> object, const affine &transform)
+        : object(std::move(object)), to_world(transform)
+    {
+        while (auto inner = std::dynamic_pointer_cast<instance>(this->object))
+        {
+            to_world = to_world * inner->to_world;
+            this->object = inner->object;
+        }
+        to_object = to_world.inverse();
+        bbox = to_world.box(this->object->bounding_box());
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        auto local = local_ray(r);
+        auto pending = rec.instanced;
+        rec.instanced = nullptr;
+        if (!object->hit(local, ray_t, rec))
+        {
+            rec.instanced = pending;
+            return false;
+        }
+        defer(local, rec, pending);
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        return object->occluded(local_ray(r), ray_t);
+    }
+
+    // the lanes moved into object space together, so a bvh below keeps tracing them as a packet
+    int hit_packet(const ray_packet &rays, int mask, double t_min, double *t_max, hit_record *recs) const override
+    {
+        ray_packet local;
+        const hittable *pending[packet_size];
+        for (int l = 0; l < packet_size; l++)
+        {
+            local.set(l, local_ray(rays.rays[mask >> l & 1 ? l : 0]));
+            pending[l] = recs[l].instanced;
+            recs[l].instanced = nullptr;
+        }
+        int hits = object->hit_packet(local, mask, t_min, t_max, recs);
+        for (int l = 0; l < packet_size; l++)
+        {
+            if (hits >> l & 1)
+                defer(local.rays[l], recs[l], pending[l]);
+            else
+                recs[l].instanced = pending[l];
+        }
+        return hits;
+    }
+
+    void set_surface(const ray &r, hit_record &rec) const override
+    {
+        rec.object = rec.instanced;
+        rec.instanced = nullptr;
+        rec.complete(local_ray(r));
+        place(rec);
+    }
+
+    aabb bounding_box() const override
+    {
+        return bbox;
+    }
+};
+
+class translate : public instance
+{
+public:
+    translate(shared_ptr<hittable> p, const vec3 &displacement)
+        : instance(std::move(p), affine::translation(displacement)) {}
+};
+
+class rotate_y : public instance
+{
+public:
+    // angle in degrees
+    rotate_y(shared_ptr<hittable> p, double angle)
+        : instance(std::move(p), affine::rotation_y(angle)) {}
+};
@@ -0,0 +1,449 @@
+#pragma once
+
+#include "utils.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "color.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+
+// weight of a sample drawn with density a when b is the density of the other strategy
+inline double power_heuristic(double a, double b)
+{
+    return a * a / (a * a + b * b);
+}
+
+/**
+ * @brief an emitting quad or sphere of the world, copied out so it can be sampled directly
+ */
+struct emitter
+{
+    enum class shape : uint8_t
+    {
+        quad,
+        sphere,
+    };
+
+    shape kind;
+    point3 origin; // corner of a quad, center of a sphere at time 0
+    vec3 u, v;     // edges of a quad; u is the motion of a sphere
+    vec3 normal;   // unit normal of a quad
+    double size;   // area of a quad, radius of a sphere
+    const material *mat;
+};
+
+// a point sampled on a light, as seen from the shading point
+struct light_sample
+{
+    vec3 direction; // unit vector towards the point
+    double distance;
+    double pdf; // per solid angle, for the chosen light
+    color radiance;
+};
+
+/**
+ * @brief the emitters of a world, for next event estimation: at every diffuse hit one light is
+ * picked, a point on it is sampled (area sampling on quads, the visible cone of spheres) and a
+ * shadow ray decides whether it contributes. Scattered rays that hit an emitter are weighted
+ * against the light sample by multiple importance sampling, so each way of finding a light
+ * counts where it is the better one.
+ *
+ * The light is picked by walking a binary tree over the emitters that stores the bounds and
+ * emitted power of every subtree. Each step goes left or right in proportion to an estimate of
+ * how much the two subtrees can contribute to the shading point, so with thousands of lights the
+ * few near ones are picked most of the time, in O(log n). Without the tree every light is
+ * equally likely, which is only kept to compare against.
+ *
+ * Emitters are collected from the top level lists and BVHs of the world. Lights under instances,
+ * in media or meshes are not sampled; scattered rays that hit them get the full weight
+ */
+class light_list
+{
+private:
+    struct light_node
+    {
+        aabb bounds;
+        double power;    // luminance times area, summed over the subtree
+        uint32_t second; // interior node: index of the second child, the first one follows the node. 0 for leaves
+        uint32_t light;  // leaf: index into lights
+    };
+
+    // past this depth subtrees are split at the median, which keeps any path below 64 steps
+    static constexpr int max_midpoint_depth = 32;
+
+    struct key
+    {
+        const hittable *object;
+        uint32_t primitive;
+
+        bool operator==(const key &other) const { return object == other.object && primitive == other.primitive; }
+    };
+
+    struct key_hash
+    {
+        size_t operator()(const key &k) const
+        {
+            return std::hash<const void *>()(k.object) ^ (static_cast<size_t>(k.primitive) * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    vector<emitter> lights;
+    vector<light_node> nodes; // empty when lights are picked uniformly
+    vector<uint64_t> trails; // per light: bit k set if its leaf is in the second child at depth k
+    // the emitters as hit records name them before complete(): the hit object and primitive
+    std::unordered_map<key, uint32_t, key_hash> index_of;
+
+    void add(const emitter &e, const hittable *object, uint32_t primitive)
+    {
+        index_of.emplace(key{object, primitive}, static_cast<uint32_t>(lights.size()));
+        lights.push_back(e);
+    }
+
+    void add_quad(const quad &q)
+    {
+        if (!q.mat->is_emitting())
+            return;
+        auto area = cross(q.u, q.v).length();
+        if (area > 0)
+            add({emitter::shape::quad, q.Q, q.u, q.v, q.normal, area, q.mat.get()}, &q, 0);
+    }
+
+    void add_sphere(const point3 &center, const vec3 &motion, double radius, const material *mat,
+                    const hittable *object, uint32_t primitive)
+    {
+        if (mat->is_emitting() && radius > 0)
+            add({emitter::shape::sphere, center, motion, vec3(), vec3(), radius, mat}, object, primitive);
+    }
+
+    void gather(const hittable &object)
+    {
+        if (auto list = dynamic_cast<const hittable_list *>(&object))
+        {
+            for (const auto &child : list->get_objects())
+                gather(*child);
+        }
+        else if (auto tree = dynamic_cast<const bvh *>(&object))
+        {
+            const auto &primitives = tree->primitive_storage();
+            for (const auto &s : primitives.sphere_storage())
+                add_sphere(s.center1, s.center_vec, s.radius, s.mat.get(), &s, 0);
+            for (const auto &q : primitives.quad_storage())
+                add_quad(q);
+            for (const auto &child : primitives.other_storage())
+                gather(*child);
+        }
+        else if (auto q = dynamic_cast<const quad *>(&object))
+            add_quad(*q);
+        else if (auto s = dynamic_cast<const sphere *>(&object))
+            add_sphere(s->center1, s->center_vec, s->radius, s->mat.get(), s, 0);
+    }
+
+    static aabb bounds(const emitter &e)
+    {
+        if (e.kind == emitter::shape::quad)
+            return aabb(aabb(e.origin, e.origin + e.u + e.v), aabb(e.origin + e.u, e.origin + e.v)).pad();
+        auto r = vec3(e.size, e.size, e.size);
+        return aabb(aabb(e.origin - r, e.origin + r), aabb(e.origin + e.u - r, e.origin + e.u + r));
+    }
+
+    // emitted luminance at the middle of the light times its area
+    static double power(const emitter &e)
+    {
+        if (e.kind == emitter::shape::quad)
+            return luminance(e.mat->emitted(0.5, 0.5, e.origin + 0.5 * e.u + 0.5 * e.v)) * e.size;
+        return luminance(e.mat->emitted(0.5, 0.5, e.origin)) * 4 * PI * e.size * e.size;
+    }
+
+    uint32_t build(uint32_t *first, uint32_t *last, int depth, uint64_t trail)
+    {
+        auto index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back({});
+        if (last - first == 1)
+        {
+            nodes[index] = {bounds(lights[*first]), power(lights[*first]), 0, *first};
+            trails[*first] = trail;
+            return index;
+        }
+
+        auto centroid = [&](uint32_t i) { return bounds(lights[i]).centroid(); };
+        aabb centroids(centroid(*first), centroid(*first));
+        for (auto i = first + 1; i < last; i++)
+            centroids = aabb(centroids, aabb(centroid(*i), centroid(*i)));
+        int axis = centroids.longest_axis();
+        auto split = centroids.axis(axis).min + centroids.axis(axis).size() / 2;
+        auto mid = std::partition(first, last, [&](uint32_t i) { return centroid(i)[axis] < split; });
+        if (mid == first || mid == last || depth >= max_midpoint_depth)
+        {
+            mid = first + (last - first) / 2;
+            std::nth_element(first, mid, last,
+                             [&](uint32_t a, uint32_t b) { return centroid(a)[axis] < centroid(b)[axis]; });
+        }
+
+        build(first, mid, depth + 1, trail);
+        auto second = build(mid, last, depth + 1, trail | 1ull << depth);
+        const auto &a = nodes[index + 1], &b = nodes[second];
+        nodes[index] = {aabb(a.bounds, b.bounds), a.power + b.power, second, 0};
+        return index;
+    }
+
+    /**
+     * @brief estimated contribution of the lights of a node to the point p: their power over the
+     * squared distance to the center, times the largest cosine any point of the bounding sphere
+     * can make with n. Inside the bounding sphere the distance is only kept from going below a
+     * quarter of the radius, so nodes that contain p still favour the child whose center is closer.
+     * Only an estimate, but 0 only if nothing in the node can light p
+     * @param n unit normal of the side of a surface that p scatters to, or zero if p scatters
+     * into all directions
+     */
+    static double importance(const light_node &node, const point3 &p, const vec3 &n)
+    {
+        auto to_center = node.bounds.centroid() - p;
+        auto d2 = to_center.length_squared();
+        auto extent = vec3(node.bounds.x.size(), node.bounds.y.size(), node.bounds.z.size());
+        auto r2 = fmax(extent.length_squared() / 4, 1e-12);
+        if (d2 <= r2)
+            return node.power / fmax(d2, r2 / 16);
+
+        double cosine = 1;
+        if (n.x() != 0 || n.y() != 0 || n.z() != 0)
+        {
+            auto d = sqrt(d2);
+            auto cos_i = dot(n, to_center) / d;
+            auto sin2_b = r2 / d2;
+            auto cos_b = sqrt(1 - sin2_b);
+            // the angle between n and the center less the angular radius of the bounding sphere
+            if (cos_i < cos_b)
+            {
+                auto sin_i = sqrt(fmax(0.0, 1 - cos_i * cos_i));
+                cosine = cos_i * cos_b + sin_i * sqrt(sin2_b);
+                if (cosine <= 0)
+                    return 0;
+            }
+        }
+        return node.power * cosine / d2;
+    }
+
+    // chance of taking the first child of an interior node, -1 if neither child can light p
+    double first_probability(uint32_t node, const point3 &p, const vec3 &n) const
+    {
+        auto a = importance(nodes[node + 1], p, n);
+        auto b = importance(nodes[nodes[node].second], p, n);
+        return a + b > 0 ? a / (a + b) : -1;
+    }
+
+    // sine and one minus cosine of the half angle of the cone in which a sphere is seen from p
+    static bool cone(const emitter &e, const point3 &p, double time, vec3 &axis, double &distance, double &one_minus_cos)
+    {
+        axis = e.origin + time * e.u - p;
+        auto d2 = axis.length_squared();
+        auto r2 = e.size * e.size;
+        if (d2 <= r2)
+            return false; // inside the sphere
+        distance = sqrt(d2);
+        axis /= distance;
+        auto sin2 = r2 / d2;
+        one_minus_cos = sin2 / (1 + sqrt(1 - sin2)); // 1 - sqrt(1 - sin2) without cancellation
+        return true;
+    }
+
+    static bool sample(const emitter &e, const point3 &p, double time, light_sample &s)
+    {
+        if (e.kind == emitter::shape::quad)
+        {
+            auto a = random_double(), b = random_double();
+            auto x = e.origin + a * e.u + b * e.v;
+            auto d = x - p;
+            s.distance = d.length();
+            s.direction = d / s.distance;
+            auto cosine = fabs(dot(e.normal, s.direction));
+            if (cosine < 1e-8)
+                return false;
+            s.pdf = s.distance * s.distance / (cosine * e.size);
+            s.radiance = e.mat->emitted(a, b, x);
+            return true;
+        }
+
+        vec3 w;
+        double dc, one_minus_cos;
+        if (!cone(e, p, time, w, dc, one_minus_cos))
+            return false;
+        auto cos_theta = 1 - random_double() * one_minus_cos;
+        auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta * cos_theta));
+        auto phi = 2 * PI * random_double();
+        auto t2 = unit(cross(w, fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0)));
+        auto t1 = cross(t2, w);
+        s.direction = unit(sin_theta * cos(phi) * t1 + sin_theta * sin(phi) * t2 + cos_theta * w);
+
+        // nearest intersection with the sphere, grazing directions are clamped onto it
+        auto h = dc * dot(s.direction, w);
+        auto delta = fmax(0.0, h * h - (dc * dc - e.size * e.size));
+        s.distance = h - sqrt(delta);
+        auto x = p + s.distance * s.direction;
+        auto center = e.origin + time * e.u;
+        double u, v;
+        sphere::get_sphere_uv((x - center) / e.size, u, v);
+        s.pdf = 1 / (2 * PI * one_minus_cos);
+        s.radiance = e.mat->emitted(u, v, x);
+        return true;
+    }
+
+public:
+    light_list() = default;
+    explicit light_list(const hittable &world, bool tree = true)
+    {
+        gather(world);
+        if (lights.empty() || !tree)
+            return;
+        vector<uint32_t> order(lights.size());
+        std::iota(order.begin(), order.end(), 0);
+        trails.resize(lights.size());
+        nodes.reserve(2 * lights.size() - 1);
+        build(order.data(), order.data() + order.size(), 0, 0);
+    }
+
+    size_t size() const { return lights.size(); }
+    bool has_tree() const { return !nodes.empty(); }
+    bool empty() const { return lights.empty(); }
+
+    /**
+     * @brief the normal lights are picked with at the hit rec of r_in, see importance(). Zero
+     * unless the material only scatters to the side the normal points to
+     */
+    static vec3 selection_normal(const ray &r_in, const hit_record &rec)
+    {
+        return rec.mat->scattering_pdf(r_in, rec, -rec.normal) == 0 ? rec.normal : vec3(0, 0, 0);
+    }
+
+    /**
+     * @brief pick a light for the shading point p by walking the tree, u in [0, 1) decides
+     * @param n see selection_normal()
+     * @param pmf returned probability of the pick
+     * @return index of the light, -1 if no light can reach p
+     */
+    int select(const point3 &p, const vec3 &n, double u, double &pmf) const
+    {
+        if (!has_tree())
+        {
+            pmf = 1.0 / lights.size();
+            return static_cast<int>(std::min(static_cast<size_t>(u * lights.size()), lights.size() - 1));
+        }
+        pmf = 1;
+        uint32_t node = 0;
+        while (nodes[node].second)
+        {
+            auto first = first_probability(node, p, n);
+            if (first < 0)
+                return -1;
+            if (u < first)
+            {
+                u = fmin(u / first, 1 - 1e-16);
+                pmf *= first;
+                node++;
+            }
+            else
+            {
+                u = fmin((u - first) / (1 - first), 1 - 1e-16);
+                pmf *= 1 - first;
+                node = nodes[node].second;
+            }
+        }
+        return static_cast<int>(nodes[node].light);
+    }
+
+    // probability with which select() picks light for the shading point p with normal n
+    double pmf(int light, const point3 &p, const vec3 &n) const
+    {
+        if (!has_tree())
+            return 1.0 / lights.size();
+        double pmf = 1;
+        uint32_t node = 0;
+        for (auto trail = trails[light]; nodes[node].second; trail >>= 1)
+        {
+            auto first = first_probability(node, p, n);
+            if (first < 0)
+                return 0;
+            if (trail & 1)
+            {
+                pmf *= 1 - first;
+                node = nodes[node].second;
+            }
+            else
+            {
+                pmf *= first;
+                node++;
+            }
+        }
+        return pmf;
+    }
+
+    /**
+     * @brief the light a hit record points at, before complete() is called on it
+     * @return -1 if the hit object is not a sampled light
+     */
+    int find(const hit_record &rec) const
+    {
+        auto it = index_of.find(key{rec.object, rec.primitive});
+        return it == index_of.end() ? -1 : static_cast<int>(it->second);
+    }
+
+    /**
+     * @brief density per solid angle with which sample_direct() picks the direction of r
+     * @param light the light r hit, as returned by find(), -1 gives 0
+     * @param n selection_normal() at the origin of r
+     * @param rec completed hit of r on the light
+     */
+    double pdf(int light, const ray &r, const vec3 &n, const hit_record &rec) const
+    {
+        if (light < 0)
+            return 0;
+        const auto &e = lights[light];
+        double select_pdf = pmf(light, r.origin(), n);
+        if (select_pdf == 0)
+            return 0;
+        if (e.kind == emitter::shape::quad)
+        {
+            auto length = r.direction().length();
+            auto cosine = fabs(dot(e.normal, r.direction())) / length;
+            if (cosine < 1e-8)
+                return 0;
+            auto distance = rec.t * length;
+            return select_pdf * distance * distance / (cosine * e.size);
+        }
+        vec3 w;
+        double dc, one_minus_cos;
+        if (!cone(e, r.origin(), r.time(), w, dc, one_minus_cos))
+            return 0;
+        return select_pdf / (2 * PI * one_minus_cos);
+    }
+
+    /**
+     * @brief one light sample for the diffuse hit rec of r_in: the emitted radiance that reaches
+     * rec.p from a random point on a random light, scattered towards the viewer and weighted
+     * against scattering by the power heuristic. Multiply by the path throughput
+     */
+    color sample_direct(const ray &r_in, const hit_record &rec, const hittable &world) const
+    {
+        double select_pdf;
+        auto index = select(rec.p, selection_normal(r_in, rec), random_double(), select_pdf);
+        light_sample s;
+        if (index < 0 || !sample(lights[index], rec.p, r_in.time(), s))
+            return color(0, 0, 0);
+        double scatter_pdf;
+        auto f = rec.mat->evaluate(r_in, rec, s.direction, scatter_pdf);
+        if (scatter_pdf == 0 || s.radiance.near_zero())
+            return color(0, 0, 0);
+        // stop short of the light itself
+        if (world.occluded(ray(rec.p, s.direction, r_in.time()), interval(0.001, s.distance * (1 - 1e-6))))
+            return color(0, 0, 0);
+        auto light_pdf = s.pdf * select_pdf;
+        return f * s.radiance * (power_heuristic(light_pdf, scatter_pdf) / light_pdf);
+    }
+};
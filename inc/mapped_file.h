@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief read only memory map of a whole file. Pages are loaded by the OS on first access,
+ * so large assets are parsed without copying them into a buffer first
+ */
+class mapped_file
+{
+private:
+    const char *ptr = nullptr;
+    size_t length = 0;
+
+public:
+    mapped_file() = default;
+    explicit mapped_file(const std::string &path) { open(path); }
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    mapped_file(mapped_file &&other) noexcept : ptr(other.ptr), length(other.length)
+    {
+        other.ptr = nullptr;
+        other.length = 0;
+    }
+
+    mapped_file &operator=(mapped_file &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            ptr = other.ptr;
+            length = other.length;
+            other.ptr = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    /**
+     * @return false if the file is missing, empty or cannot be mapped
+     */
+    bool open(const std::string &path)
+    {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return false;
+        // the view keeps the mapping alive
+        ptr = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (!ptr)
+            return false;
+        length = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        ptr = static_cast<const char *>(p);
+        length = st.st_size;
+#endif
+        return true;
+    }
+
+    void close()
+    {
+        if (!ptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(ptr);
+#else
+        munmap(const_cast<char *>(ptr), length);
+#endif
+        ptr = nullptr;
+        length = 0;
+    }
+
+    bool is_open() const { return ptr != nullptr; }
+    const char *data() const { return ptr; }
+    size_t size() const { return length; }
+};
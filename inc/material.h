@@ -4,10 +4,47 @@
 #include "hittable.h"
 #include "texture.h"
 
+#include <cstddef>
+
+// concrete type of a material, lets batch processing group hits without virtual calls
+enum class material_type
+{
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light,
+    isotropic,
+    custom, // any other user material
+    count
+};
+
+class lambertian;
+class metal;
+class dielectric;
+class diffuse_light;
+class isotropic;
+
 class material
 {
+private:
+    // batch shading casts to the class a tag names, so only those final classes may set one
+    friend class lambertian;
+    friend class metal;
+    friend class dielectric;
+    friend class diffuse_light;
+    friend class isotropic;
+
+    material_type type_id = material_type::custom;
+
+    explicit material(material_type type) : type_id(type) {}
+
 protected:
     bool emitting_flag = false;
+    bool uv_flag = true; // whether scattering or emission reads the texture coordinates
+    bool diffuse_flag = false; // whether scattered() draws from a density that evaluate() gives
+
+    material() = default;
+
 public:
     virtual ~material() = default;
     virtual color emitted(double u, double v, const point3 &p) const
@@ -15,20 +52,57 @@ public:
         return color(0, 0, 0);
     }
     virtual bool scattered(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const = 0;
-    virtual bool is_emitting() const
+
+    /**
+     * @brief scattering towards a given direction, for light sampling. Only diffuse materials
+     * implement it, mirrors and glass scatter into single directions that a light sample never hits
+     * @param direction need not be a unit vector
+     * @param pdf returned density per solid angle with which scattered() picks direction
+     * @return the attenuation scattered() would return, times pdf
+     */
+    virtual color evaluate(const ray &r_in, const hit_record &rec, const vec3 &direction, double &pdf) const
+    {
+        pdf = 0;
+        return color(0, 0, 0);
+    }
+
+    // density per solid angle with which scattered() picks direction, 0 for non diffuse materials
+    virtual double scattering_pdf(const ray &r_in, const hit_record &rec, const vec3 &direction) const
+    {
+        return 0;
+    }
+
+    // only emitting materials are asked for emitted()
+    bool is_emitting() const
     {
         return emitting_flag;
     }
+    bool needs_uv() const
+    {
+        return uv_flag;
+    }
+    // whether lights are sampled at hits of this material, see evaluate()
+    bool is_diffuse() const
+    {
+        return diffuse_flag;
+    }
+    material_type type() const
+    {
+        return type_id;
+    }
 };
 
-class lambertian: public material
+class lambertian final : public material
 {
 private:
     shared_ptr<texture> albedo = nullptr;
 
 public:
-    lambertian(const color &a) : albedo(make_shared<solid_color>(a)) {}
-    lambertian(const shared_ptr<texture> &tex) : albedo(tex) {}
+    lambertian(const color &a) : lambertian(make_shared<solid_color>(a)) {}
+    lambertian(const shared_ptr<texture> &tex) : material(material_type::lambertian), albedo(tex)
+    {
+        diffuse_flag = true;
+    }
 
     bool scattered(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
     {
@@ -39,16 +113,34 @@ public:
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
+
+    // scattered() is cosine weighted: pdf = cos / pi
+    color evaluate(const ray &r_in, const hit_record &rec, const vec3 &direction, double &pdf) const override
+    {
+        pdf = scattering_pdf(r_in, rec, direction);
+        if (pdf == 0)
+            return color(0, 0, 0);
+        return albedo->value(rec.u, rec.v, rec.p) * pdf;
+    }
+
+    double scattering_pdf(const ray &r_in, const hit_record &rec, const vec3 &direction) const override
+    {
+        auto cosine = dot(rec.normal, unit(direction));
+        return cosine > 0 ? cosine / PI : 0;
+    }
 };
 
-class metal: public material
+class metal final : public material
 {
 private:
     color albedo;
     double fuzziness; // glossy reflection
 
 public:
-    metal(const color &a, double f = 0.0) : albedo(a), fuzziness(f) {}
+    metal(const color &a, double f = 0.0) : material(material_type::metal), albedo(a), fuzziness(f)
+    {
+        uv_flag = false;
+    }
 
     bool scattered(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
     {
@@ -59,13 +151,16 @@ public:
     }
 };
 
-class dielectric: public material
+class dielectric final : public material
 {
 private:
     double ir; // index of refraction
 
 public:
-    dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+    dielectric(double index_of_refraction) : material(material_type::dielectric), ir(index_of_refraction)
+    {
+        uv_flag = false;
+    }
 
     bool scattered(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
     {
@@ -100,13 +195,16 @@ private:
     }
 };
 
-class diffuse_light: public material
+class diffuse_light final : public material
 {
 private:
     shared_ptr<texture> emit;
 public:
-    diffuse_light(shared_ptr<texture> a) : emit(a) { emitting_flag = true; }
-    diffuse_light(color c) : emit(make_shared<solid_color>(c)) { emitting_flag = true; }
+    diffuse_light(shared_ptr<texture> a) : material(material_type::diffuse_light), emit(a)
+    {
+        emitting_flag = true;
+    }
+    diffuse_light(color c) : diffuse_light(make_shared<solid_color>(c)) {}
 
     bool scattered(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
     {
@@ -119,14 +217,17 @@ public:
     }
 };
 
-class isotropic : public material
+class isotropic final : public material
 {
 private:
     shared_ptr<texture> albedo;
 
 public:
-    isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
-    isotropic(shared_ptr<texture> a) : albedo(a) {}
+    isotropic(color c) : isotropic(make_shared<solid_color>(c)) {}
+    isotropic(shared_ptr<texture> a) : material(material_type::isotropic), albedo(a)
+    {
+        diffuse_flag = true;
+    }
 
     bool scattered(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
     {
@@ -134,4 +235,68 @@ public:
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
-};
\ No newline at end of file
+
+    // uniform over the sphere of directions
+    color evaluate(const ray &r_in, const hit_record &rec, const vec3 &direction, double &pdf) const override
+    {
+        pdf = scattering_pdf(r_in, rec, direction);
+        return albedo->value(rec.u, rec.v, rec.p) * pdf;
+    }
+
+    double scattering_pdf(const ray &r_in, const hit_record &rec, const vec3 &direction) const override
+    {
+        return 1 / (4 * PI);
+    }
+};
+
+// one hit to shade in a batch, see scatter_batch()
+struct scatter_request
+{
+    const ray *r_in;
+    const hit_record *rec;
+    pcg32 *rng; // random stream of the path, swapped in for the thread's during the call. May be null
+    color attenuation; // returned
+    ray scattered;     // returned
+    bool alive;        // returned, false if the path is absorbed
+};
+
+namespace material_batch
+{
+    template <typename M>
+    void scatter(scatter_request *requests, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            auto &q = requests[i];
+            if (q.rng)
+                thread_rng() = *q.rng;
+            // M is final, so the call is direct; for material itself it goes through the vtable
+            q.alive = static_cast<const M *>(q.rec->mat)->scattered(*q.r_in, *q.rec, q.attenuation, q.scattered);
+            if (q.rng)
+                *q.rng = thread_rng();
+        }
+    }
+
+    using scatter_fn = void (*)(scatter_request *, size_t);
+
+    // batch shading per material type, indexed by material_type
+    constexpr scatter_fn scatter_table[] = {
+        &scatter<lambertian>,
+        &scatter<metal>,
+        &scatter<dielectric>,
+        &scatter<diffuse_light>,
+        &scatter<isotropic>,
+        &scatter<material>, // custom
+    };
+    static_assert(sizeof(scatter_table) / sizeof(scatter_fn) == static_cast<size_t>(material_type::count),
+                  "every material type needs a batch entry");
+}
+
+/**
+ * @brief scatter n hits whose materials all have the given type, e.g. one material group of the
+ * wavefront integrator. The type is dispatched once for the batch instead of once per hit
+ */
+inline void scatter_batch(material_type type, scatter_request *requests, size_t n)
+{
+    material_batch::scatter_table[static_cast<size_t>(type)](requests, n);
+}
@@ -0,0 +1,551 @@
+#pragma once
+
+#include "utils.h"
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+/**
+ * @brief loaders filling a mesh_data from OBJ and binary PLY files. The file is memory mapped and
+ * split into chunks that are parsed concurrently, each into buffers of its own that are then
+ * concatenated. On failure the reason is written to std::cerr and false is returned
+ */
+namespace mesh_io
+{
+    // smallest chunk worth a thread of its own, in bytes
+    constexpr size_t parallel_grain = 1 << 20;
+
+    inline int thread_count(size_t bytes)
+    {
+        auto n = std::max(1u, std::thread::hardware_concurrency());
+        return static_cast<int>(std::max<size_t>(1, std::min<size_t>(n, bytes / parallel_grain)));
+    }
+
+    // run fn(c) for c in [0, n_chunks) concurrently
+    template <typename F>
+    void parallel_chunks(int n_chunks, F &&fn)
+    {
+        vector<std::future<void>> tasks;
+        for (int c = 1; c < n_chunks; c++)
+            tasks.push_back(std::async(std::launch::async, [&, c] { fn(c); }));
+        fn(0);
+        for (auto &task : tasks)
+            task.get();
+    }
+
+    inline bool fail(const std::string &path, const std::string &reason)
+    {
+        std::cerr << "mesh " << path << ": " << reason << std::endl;
+        return false;
+    }
+
+    inline bool check_indices(const std::string &path, const mesh_data &mesh)
+    {
+        auto n = mesh.vertex_count();
+        for (auto i : mesh.indices)
+            if (i >= n)
+                return fail(path, "vertex index out of range");
+        if (mesh.indices.empty())
+            return fail(path, "no triangles");
+        return true;
+    }
+
+    // ----- OBJ -----
+
+    inline bool is_blank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char *skip_blanks(const char *p, const char *end)
+    {
+        while (p < end && is_blank(*p))
+            p++;
+        return p;
+    }
+
+    inline const char *line_end(const char *p, const char *end)
+    {
+        auto nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        return nl ? nl : end;
+    }
+
+    // whether the line starting at p is a vertex position, "v" followed by a blank
+    inline bool is_position(const char *p, const char *end)
+    {
+        return end - p >= 2 && p[0] == 'v' && is_blank(p[1]);
+    }
+
+    struct obj_chunk
+    {
+        const char *begin, *end;
+        size_t first_vertex = 0; // positions before this chunk
+        vector<float> positions;
+        vector<uint32_t> indices;
+        bool ok = true;
+    };
+
+    /**
+     * @brief parse the "v" and "f" lines of a chunk, other statements are skipped. Faces are
+     * triangulated as fans, of the v/vt/vn references only the position index is used
+     */
+    inline void parse_obj_chunk(obj_chunk &chunk)
+    {
+        vector<uint32_t> face;
+        for (const char *p = chunk.begin; p < chunk.end;)
+        {
+            auto eol = line_end(p, chunk.end);
+            auto s = skip_blanks(p, eol);
+            if (is_position(s, eol))
+            {
+                s += 2;
+                for (int k = 0; k < 3; k++)
+                {
+                    float x;
+                    auto res = std::from_chars(skip_blanks(s, eol), eol, x);
+                    if (res.ec != std::errc())
+                    {
+                        chunk.ok = false;
+                        return;
+                    }
+                    chunk.positions.push_back(x);
+                    s = res.ptr;
+                }
+            }
+            else if (eol - s >= 2 && s[0] == 'f' && is_blank(s[1]))
+            {
+                face.clear();
+                s = skip_blanks(s + 2, eol);
+                while (s < eol)
+                {
+                    long long i;
+                    auto res = std::from_chars(s, eol, i);
+                    if (res.ec != std::errc() || i == 0)
+                    {
+                        chunk.ok = false;
+                        return;
+                    }
+                    // 1-based, negative indices count back from the last position read
+                    auto local = static_cast<long long>(chunk.positions.size() / 3);
+                    auto global = i > 0 ? i - 1 : static_cast<long long>(chunk.first_vertex) + local + i;
+                    face.push_back(global < 0 ? UINT32_MAX : static_cast<uint32_t>(global));
+                    s = res.ptr;
+                    while (s < eol && !is_blank(*s))
+                        s++;
+                    s = skip_blanks(s, eol);
+                }
+                for (size_t k = 2; k < face.size(); k++)
+                {
+                    chunk.indices.push_back(face[0]);
+                    chunk.indices.push_back(face[k - 1]);
+                    chunk.indices.push_back(face[k]);
+                }
+            }
+            p = eol + 1;
+        }
+    }
+
+    inline bool load_obj(const std::string &path, mesh_data &mesh)
+    {
+        mapped_file file(path);
+        if (!file.is_open())
+            return fail(path, "cannot be opened");
+        const char *data = file.data(), *end = data + file.size();
+
+        // chunks start at line starts
+        int n_chunks = thread_count(file.size());
+        vector<obj_chunk> chunks(n_chunks);
+        const char *p = data;
+        for (int c = 0; c < n_chunks; c++)
+        {
+            chunks[c].begin = p;
+            p = c + 1 == n_chunks ? end : std::max(p, data + file.size() * (c + 1) / n_chunks);
+            if (p < end)
+                p = std::min(end, line_end(p, end) + 1);
+            chunks[c].end = p;
+        }
+
+        // negative indices are relative to the positions read so far, so count those of each chunk first
+        vector<size_t> counts(n_chunks, 0);
+        parallel_chunks(n_chunks, [&](int c)
+        {
+            for (const char *q = chunks[c].begin; q < chunks[c].end;)
+            {
+                auto eol = line_end(q, chunks[c].end);
+                if (is_position(skip_blanks(q, eol), eol))
+                    counts[c]++;
+                q = eol + 1;
+            }
+        });
+        for (int c = 1; c < n_chunks; c++)
+            chunks[c].first_vertex = chunks[c - 1].first_vertex + counts[c - 1];
+
+        parallel_chunks(n_chunks, [&](int c) { parse_obj_chunk(chunks[c]); });
+
+        mesh = mesh_data();
+        size_t n_positions = 0, n_indices = 0;
+        for (const auto &chunk : chunks)
+        {
+            if (!chunk.ok)
+                return fail(path, "malformed vertex or face");
+            n_positions += chunk.positions.size();
+            n_indices += chunk.indices.size();
+        }
+        mesh.positions.reserve(n_positions);
+        mesh.indices.reserve(n_indices);
+        for (auto &chunk : chunks)
+        {
+            mesh.positions.insert(mesh.positions.end(), chunk.positions.begin(), chunk.positions.end());
+            mesh.indices.insert(mesh.indices.end(), chunk.indices.begin(), chunk.indices.end());
+            chunk = obj_chunk();
+        }
+        return check_indices(path, mesh);
+    }
+
+    // ----- PLY -----
+
+    enum class ply_type : uint8_t { int8, uint8, int16, uint16, int32, uint32, float32, float64, invalid };
+
+    inline ply_type parse_ply_type(const std::string &name)
+    {
+        if (name == "char" || name == "int8") return ply_type::int8;
+        if (name == "uchar" || name == "uint8") return ply_type::uint8;
+        if (name == "short" || name == "int16") return ply_type::int16;
+        if (name == "ushort" || name == "uint16") return ply_type::uint16;
+        if (name == "int" || name == "int32") return ply_type::int32;
+        if (name == "uint" || name == "uint32") return ply_type::uint32;
+        if (name == "float" || name == "float32") return ply_type::float32;
+        if (name == "double" || name == "float64") return ply_type::float64;
+        return ply_type::invalid;
+    }
+
+    inline size_t ply_size(ply_type type)
+    {
+        static constexpr size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+        return sizes[static_cast<int>(type)];
+    }
+
+    // read a value of the given type, byte swapped for big endian files
+    inline double read_ply(const char *p, ply_type type, bool swap)
+    {
+        unsigned char bytes[8];
+        auto size = ply_size(type);
+        memcpy(bytes, p, size);
+        if (swap)
+            std::reverse(bytes, bytes + size);
+        switch (type)
+        {
+        case ply_type::int8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+        case ply_type::uint8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+        case ply_type::int16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+        case ply_type::uint16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+        case ply_type::int32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+        case ply_type::uint32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+        case ply_type::float32: { float v; memcpy(&v, bytes, 4); return v; }
+        case ply_type::float64: { double v; memcpy(&v, bytes, 8); return v; }
+        default: return 0;
+        }
+    }
+
+    // a list length or index read as any type, SIZE_MAX if negative, NaN or beyond 32 bits
+    inline size_t ply_integer(double value)
+    {
+        return value >= 0 && value <= UINT32_MAX ? static_cast<size_t>(value) : SIZE_MAX;
+    }
+
+    struct ply_property
+    {
+        std::string name;
+        ply_type type = ply_type::invalid;       // of the value, or of the items of a list
+        ply_type count_type = ply_type::invalid; // valid for lists only
+    };
+
+    struct ply_element
+    {
+        std::string name;
+        size_t count = 0;
+        vector<ply_property> properties;
+
+        // record size, 0 if the element has lists and its records vary in size
+        size_t stride() const
+        {
+            size_t size = 0;
+            for (const auto &prop : properties)
+            {
+                if (prop.count_type != ply_type::invalid)
+                    return 0;
+                size += ply_size(prop.type);
+            }
+            return size;
+        }
+
+        /**
+         * @brief byte offset of property k in the record at p, or of its end for k = properties.size()
+         * @param available bytes left in the file from p, SIZE_MAX is returned if a list count lies beyond
+         */
+        size_t property_offset(const char *p, size_t available, size_t k, bool swap) const
+        {
+            size_t offset = 0;
+            for (size_t j = 0; j < k; j++)
+            {
+                const auto &prop = properties[j];
+                if (prop.count_type == ply_type::invalid)
+                {
+                    offset += ply_size(prop.type);
+                    continue;
+                }
+                if (offset + ply_size(prop.count_type) > available)
+                    return SIZE_MAX;
+                auto n = ply_integer(read_ply(p + offset, prop.count_type, swap));
+                if (n == SIZE_MAX)
+                    return SIZE_MAX;
+                offset += ply_size(prop.count_type) + n * ply_size(prop.type);
+            }
+            return offset;
+        }
+    };
+
+    inline bool load_ply(const std::string &path, mesh_data &mesh)
+    {
+        mapped_file file(path);
+        if (!file.is_open())
+            return fail(path, "cannot be opened");
+        const char *data = file.data(), *end = data + file.size();
+
+        // the header is text, terminated by a line that is "end_header"
+        if (file.size() < 3 || memcmp(data, "ply", 3) != 0)
+            return fail(path, "not a PLY file");
+        const char *header_pos = nullptr, *body = end;
+        for (const char *p = data; p < end && !header_pos;)
+        {
+            auto eol = line_end(p, end);
+            auto last = eol > p && eol[-1] == '\r' ? eol - 1 : eol;
+            if (last - p == 10 && memcmp(p, "end_header", 10) == 0)
+            {
+                header_pos = p;
+                body = std::min(end, eol + 1);
+            }
+            p = eol + 1;
+        }
+        if (!header_pos)
+            return fail(path, "not a PLY file");
+        std::istringstream header(std::string(data, header_pos));
+
+        bool swap = false;
+        vector<ply_element> elements;
+        std::string line;
+        while (std::getline(header, line))
+        {
+            std::istringstream words(line);
+            std::string keyword;
+            words >> keyword;
+            if (keyword == "format")
+            {
+                std::string format;
+                words >> format;
+                if (format == "binary_big_endian")
+                    swap = true;
+                else if (format != "binary_little_endian")
+                    return fail(path, "only binary PLY files are supported");
+            }
+            else if (keyword == "element")
+            {
+                elements.emplace_back();
+                words >> elements.back().name >> elements.back().count;
+            }
+            else if (keyword == "property" && !elements.empty())
+            {
+                ply_property prop;
+                std::string type;
+                words >> type;
+                if (type == "list")
+                {
+                    std::string count_type;
+                    words >> count_type >> type;
+                    prop.count_type = parse_ply_type(count_type);
+                    if (prop.count_type == ply_type::invalid)
+                        return fail(path, "unknown property type " + count_type);
+                }
+                prop.type = parse_ply_type(type);
+                words >> prop.name;
+                if (prop.type == ply_type::invalid)
+                    return fail(path, "unknown property type " + type);
+                elements.back().properties.push_back(prop);
+            }
+        }
+
+        mesh = mesh_data();
+        for (const auto &element : elements)
+        {
+            size_t stride = element.stride();
+            if (element.name == "vertex")
+            {
+                if (stride == 0)
+                    return fail(path, "vertices with list properties");
+                if (element.count > static_cast<size_t>(end - body) / stride)
+                    return fail(path, "truncated vertex data");
+
+                // attributes are found by name, at a fixed offset in every record
+                struct attribute
+                {
+                    size_t offset = 0;
+                    ply_type type = ply_type::invalid;
+                };
+                auto find = [&](std::initializer_list<const char *> names)
+                {
+                    attribute a;
+                    for (const auto &prop : element.properties)
+                    {
+                        for (auto name : names)
+                            if (prop.name == name)
+                            {
+                                a.type = prop.type;
+                                return a;
+                            }
+                        a.offset += ply_size(prop.type);
+                    }
+                    return attribute();
+                };
+                attribute pos[3] = {find({"x"}), find({"y"}), find({"z"})};
+                attribute normal[3] = {find({"nx"}), find({"ny"}), find({"nz"})};
+                attribute uv[2] = {find({"u", "s", "texture_u"}), find({"v", "t", "texture_v"})};
+                auto present = [](const attribute *attrs, int n)
+                {
+                    return std::all_of(attrs, attrs + n, [](const attribute &a) { return a.type != ply_type::invalid; });
+                };
+                if (!present(pos, 3))
+                    return fail(path, "vertices without positions");
+                bool has_normals = present(normal, 3), has_uvs = present(uv, 2);
+
+                mesh.positions.resize(3 * element.count);
+                if (has_normals)
+                    mesh.normals.resize(3 * element.count);
+                if (has_uvs)
+                    mesh.uvs.resize(2 * element.count);
+                int n_chunks = thread_count(element.count * stride);
+                parallel_chunks(n_chunks, [&](int c)
+                {
+                    size_t first = element.count * c / n_chunks, last = element.count * (c + 1) / n_chunks;
+                    for (size_t i = first; i < last; i++)
+                    {
+                        const char *record = body + i * stride;
+                        for (int k = 0; k < 3; k++)
+                            mesh.positions[3 * i + k] = static_cast<float>(read_ply(record + pos[k].offset, pos[k].type, swap));
+                        if (has_normals)
+                            for (int k = 0; k < 3; k++)
+                                mesh.normals[3 * i + k] = static_cast<float>(read_ply(record + normal[k].offset, normal[k].type, swap));
+                        if (has_uvs)
+                            for (int k = 0; k < 2; k++)
+                                mesh.uvs[2 * i + k] = static_cast<float>(read_ply(record + uv[k].offset, uv[k].type, swap));
+                    }
+                });
+                body += element.count * stride;
+            }
+            else if (element.name == "face")
+            {
+                size_t list = element.properties.size();
+                for (size_t k = 0; k < element.properties.size(); k++)
+                    if (element.properties[k].name == "vertex_indices" || element.properties[k].name == "vertex_index")
+                        list = k;
+                if (list == element.properties.size() || element.properties[list].count_type == ply_type::invalid)
+                    return fail(path, "faces without a vertex index list");
+                const auto &indices = element.properties[list];
+                auto count_size = ply_size(indices.count_type), item_size = ply_size(indices.type);
+
+                // records vary in size, so walk them once to find where each chunk starts and how
+                // many triangles precede it, then decode the chunks concurrently
+                int n_chunks = thread_count(end - body);
+                vector<const char *> chunk_start(n_chunks);
+                vector<size_t> chunk_triangles(n_chunks);
+                const char *p = body;
+                size_t triangles = 0;
+                int next_chunk = 0;
+                for (size_t i = 0; i < element.count; i++)
+                {
+                    for (; next_chunk < n_chunks && i == element.count * next_chunk / n_chunks; next_chunk++)
+                    {
+                        chunk_start[next_chunk] = p;
+                        chunk_triangles[next_chunk] = triangles;
+                    }
+                    size_t available = end - p;
+                    auto list_offset = element.property_offset(p, available, list, swap);
+                    auto size = element.property_offset(p, available, element.properties.size(), swap);
+                    if (size > available || list_offset + count_size > available)
+                        return fail(path, "truncated face data");
+                    auto n = ply_integer(read_ply(p + list_offset, indices.count_type, swap));
+                    triangles += n >= 3 ? n - 2 : 0;
+                    p += size;
+                }
+                for (; next_chunk < n_chunks; next_chunk++)
+                {
+                    chunk_start[next_chunk] = p;
+                    chunk_triangles[next_chunk] = triangles;
+                }
+
+                mesh.indices.resize(3 * triangles);
+                parallel_chunks(n_chunks, [&](int c)
+                {
+                    size_t first = element.count * c / n_chunks, last = element.count * (c + 1) / n_chunks;
+                    const char *q = chunk_start[c];
+                    uint32_t *out = mesh.indices.data() + 3 * chunk_triangles[c];
+                    for (size_t i = first; i < last; i++)
+                    {
+                        size_t available = end - q;
+                        auto list_offset = element.property_offset(q, available, list, swap);
+                        auto n = ply_integer(read_ply(q + list_offset, indices.count_type, swap));
+                        const char *items = q + list_offset + count_size;
+                        auto index = [&](size_t k)
+                        {
+                            // out of range values become UINT32_MAX, which check_indices() rejects
+                            auto value = ply_integer(read_ply(items + k * item_size, indices.type, swap));
+                            return static_cast<uint32_t>(std::min<size_t>(value, UINT32_MAX));
+                        };
+                        for (size_t k = 2; k < n; k++)
+                        {
+                            *out++ = index(0);
+                            *out++ = index(k - 1);
+                            *out++ = index(k);
+                        }
+                        q += element.property_offset(q, available, element.properties.size(), swap);
+                    }
+                });
+                body = p;
+            }
+            else
+            {
+                // skip elements that are not used
+                for (size_t i = 0; i < element.count; i++)
+                {
+                    size_t available = end - body;
+                    auto size = stride ? stride : element.property_offset(body, available, element.properties.size(), swap);
+                    if (size > available)
+                        return fail(path, "truncated " + element.name + " data");
+                    body += size;
+                }
+            }
+        }
+        return check_indices(path, mesh);
+    }
+
+    // load an OBJ or PLY file, chosen by extension
+    inline bool load(const std::string &path, mesh_data &mesh)
+    {
+        auto dot = path.find_last_of('.');
+        auto ext = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (ext == "obj")
+            return load_obj(path, mesh);
+        if (ext == "ply")
+            return load_ply(path, mesh);
+        return fail(path, "unknown mesh format");
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "utils.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "quad.h"
+
+#include <cstdint>
+
+/**
+ * @brief the primitives of a BVH in leaf order, stored by value with one array per type. Leaves
+ * dispatch on a type tag and call the intersector of the concrete class, which the compiler can
+ * inline, and primitives that share a leaf sit next to each other in their array.
+ * Any other hittable is kept by pointer and called through the vtable
+ */
+class primitive_array
+{
+private:
+    enum kind : uint32_t
+    {
+        sphere_kind,
+        quad_kind,
+        other_kind,
+    };
+    static constexpr int kind_shift = 30;
+    static constexpr uint32_t index_mask = (1u << kind_shift) - 1;
+
+    vector<uint32_t> refs; // per primitive: kind << kind_shift | index into the array of that kind
+    vector<sphere> spheres;
+    vector<quad> quads;
+    vector<shared_ptr<hittable>> others;
+
+public:
+    void reserve(size_t n) { refs.reserve(n); }
+
+    void add(const shared_ptr<hittable> &object)
+    {
+        // sphere and quad are final, so the cast only matches the exact class
+        if (auto s = dynamic_cast<const sphere *>(object.get()))
+        {
+            refs.push_back(sphere_kind << kind_shift | static_cast<uint32_t>(spheres.size()));
+            spheres.push_back(*s);
+        }
+        else if (auto q = dynamic_cast<const quad *>(object.get()))
+        {
+            refs.push_back(quad_kind << kind_shift | static_cast<uint32_t>(quads.size()));
+            quads.push_back(*q);
+        }
+        else
+        {
+            refs.push_back(other_kind << kind_shift | static_cast<uint32_t>(others.size()));
+            others.push_back(object);
+        }
+    }
+
+    size_t size() const { return refs.size(); }
+    const vector<sphere> &sphere_storage() const { return spheres; }
+    const vector<quad> &quad_storage() const { return quads; }
+    const vector<shared_ptr<hittable>> &other_storage() const { return others; }
+    size_t sphere_count() const { return spheres.size(); }
+    size_t quad_count() const { return quads.size(); }
+    size_t other_count() const { return others.size(); }
+
+    /**
+     * @brief call f with primitive i as its concrete type
+     * @param f generic callable, invoked with a const sphere &, const quad & or const hittable &
+     */
+    template <typename F>
+    decltype(auto) visit(uint32_t i, F &&f) const
+    {
+        auto ref = refs[i];
+        auto index = ref & index_mask;
+        switch (ref >> kind_shift)
+        {
+        case sphere_kind:
+            return f(spheres[index]);
+        case quad_kind:
+            return f(quads[index]);
+        default:
+            return f(static_cast<const hittable &>(*others[index]));
+        }
+    }
+
+    size_t memory_footprint() const
+    {
+        return refs.size() * sizeof(uint32_t) + spheres.size() * sizeof(sphere) + quads.size() * sizeof(quad) +
+               others.size() * sizeof(shared_ptr<hittable>);
+    }
+};
@@ -4,10 +4,13 @@
 #include "hittable.h"
 #include "material.h"
 #include "hittable_list.h"
+#include "arena.h"
 
-class quad : public hittable
+class quad final : public hittable
 {
 private:
+    friend class light_list;
+
     point3 Q;
     vec3 u, v;
     shared_ptr<material> mat;
@@ -16,6 +19,44 @@ private:
     double D; // n.p=D;
     vec3 w;
 
+    /**
+     * @brief intersect the ray with the plane of the quad
+     * @param t returned hit distance, within ray_t
+     * @param alpha returned planar coordinate of the hit point along u
+     * @param beta returned planar coordinate of the hit point along v
+     */
+    bool plane_hit(const ray &ray, interval ray_t, double &t, double &alpha, double &beta) const
+    {
+        auto denom = dot(normal, ray.direction());
+
+        // ray is parallel to the parallelogram
+        if (fabs(denom) < 1e-8)
+            return false;
+
+        t = (D - dot(normal, ray.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        auto planar_hitpt_vector = ray.at(t) - Q;
+        alpha = dot(w, cross(planar_hitpt_vector, v));
+        beta = dot(w, cross(u, planar_hitpt_vector));
+        return true;
+    }
+
+    void set_bounding_box()
+    {
+        bbox = aabb(Q, Q + u + v).pad();
+    }
+
+    bool is_interior(double a, double b, hit_record &rec) const
+    {
+        if (a < 0 || 1 < a || b < 0 || 1 < b)
+            return false;
+        rec.u = a;
+        rec.v = b;
+        return true;
+    }
+
 public:
     quad(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> m)
         : Q(Q), u(u), v(v), mat(m)
@@ -29,62 +70,94 @@ public:
 
     bool hit(const ray &ray, interval ray_t, hit_record &rec) const override
     {
-        auto denom = dot(normal, ray.direction());
-
-        // ray is parallel to the parallelogram
-        if (fabs(denom) < 1e-8)
+        double t, alpha, beta;
+        if (!plane_hit(ray, ray_t, t, alpha, beta))
             return false;
 
-        auto t = (D - dot(normal, ray.origin())) / denom;
-        if (!ray_t.contains(t))
-            return false;
-
-        auto intersection = ray.at(t);
-        auto planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
-
         if (!is_interior(alpha, beta, rec))
             return false;
 
-        rec.p = intersection;
-        rec.mat = mat;
+        rec.mat = mat.get();
         rec.t = t;
-        rec.set_face_normal(ray, normal);
-
+        rec.object = this;
+        rec.primitive = 0;
         return true;
     }
 
-    aabb bounding_box() const override
+    void set_surface(const ray &ray, hit_record &rec) const override
     {
-        return bbox;
+        rec.p = ray.at(rec.t);
+        rec.set_face_normal(ray, normal);
     }
 
-    point3 sample() const override
+    bool occluded(const ray &ray, interval ray_t) const override
     {
-        return u * random_double() + v * random_double();
+        double t, alpha, beta;
+        if (!plane_hit(ray, ray_t, t, alpha, beta))
+            return false;
+        // is_interior() also writes the planar coordinates, give it a scratch record
+        hit_record scratch;
+        return is_interior(alpha, beta, scratch);
     }
 
-    virtual void set_bounding_box()
+    int hit_packet(const ray_packet &rays, int mask, double t_min, double *t_max, hit_record *recs) const override
     {
-        bbox = aabb(Q, Q + u + v).pad();
+        double4 nx(normal.x()), ny(normal.y()), nz(normal.z());
+        auto ox = rays.origin(0), oy = rays.origin(1), oz = rays.origin(2);
+        auto dx = rays.direction(0), dy = rays.direction(1), dz = rays.direction(2);
+        auto denom = nx * dx + ny * dy + nz * dz;
+        auto t = (double4(D) - (nx * ox + ny * oy + nz * oz)) / denom;
+
+        // parallel rays give t = +-inf or NaN, which fail the range test
+        auto ok = (double4(t_min) <= t) & (t <= double4::load(t_max));
+        int candidates = movemask(ok) & mask;
+        if (!candidates)
+            return 0;
+
+        // planar coordinates of the hit point: alpha = w.(p x v), beta = w.(u x p)
+        auto px = ox + t * dx - double4(Q.x()), py = oy + t * dy - double4(Q.y()), pz = oz + t * dz - double4(Q.z());
+        auto alpha = double4(w.x()) * (py * double4(v.z()) - pz * double4(v.y())) +
+                     double4(w.y()) * (pz * double4(v.x()) - px * double4(v.z())) +
+                     double4(w.z()) * (px * double4(v.y()) - py * double4(v.x()));
+        auto beta = double4(w.x()) * (double4(u.y()) * pz - double4(u.z()) * py) +
+                    double4(w.y()) * (double4(u.z()) * px - double4(u.x()) * pz) +
+                    double4(w.z()) * (double4(u.x()) * py - double4(u.y()) * px);
+
+        alignas(32) double ts[packet_size], alphas[packet_size], betas[packet_size];
+        t.store(ts);
+        alpha.store(alphas);
+        beta.store(betas);
+
+        int hits = 0;
+        for (int l = 0; l < packet_size; l++)
+        {
+            auto &r = rays.rays[l];
+            if (!(candidates >> l & 1) || fabs(dot(normal, r.direction())) < 1e-8)
+                continue;
+            if (!is_interior(alphas[l], betas[l], recs[l]))
+                continue;
+            recs[l].mat = mat.get();
+            recs[l].t = ts[l];
+            recs[l].object = this;
+            recs[l].primitive = 0;
+            t_max[l] = ts[l];
+            hits |= 1 << l;
+        }
+        return hits;
     }
 
-    virtual bool is_interior(double a, double b, hit_record &rec) const
+    aabb bounding_box() const override
     {
-        if (a < 0 || 1 < a || b < 0 || 1 < b)
-            return false;
-        rec.u = a;
-        rec.v = b;
-        return true;
+        return bbox;
     }
 };
 
-inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat)
+inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat,
+                                     const shared_ptr<scene_arena> &arena = nullptr)
 {
     // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
 
-    auto sides = make_shared<hittable_list>();
+    auto sides = make_in<hittable_list>(arena);
 
     // Construct the two opposite vertices with the minimum and maximum coordinates.
     auto min = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
@@ -94,12 +167,12 @@ inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_pt
     auto dy = vec3(0, max.y() - min.y(), 0);
     auto dz = vec3(0, 0, max.z() - min.z());
 
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat));  // front
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right
-    sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dz, dy, mat));  // left
-    sides->add(make_shared<quad>(point3(min.x(), max.y(), max.z()), dx, -dz, mat)); // top
-    sides->add(make_shared<quad>(point3(min.x(), min.y(), min.z()), dx, dz, mat));  // bottom
+    sides->add(make_in<quad>(arena, point3(min.x(), min.y(), max.z()), dx, dy, mat));  // front
+    sides->add(make_in<quad>(arena, point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right
+    sides->add(make_in<quad>(arena, point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back
+    sides->add(make_in<quad>(arena, point3(min.x(), min.y(), min.z()), dz, dy, mat));  // left
+    sides->add(make_in<quad>(arena, point3(min.x(), max.y(), max.z()), dx, -dz, mat)); // top
+    sides->add(make_in<quad>(arena, point3(min.x(), min.y(), min.z()), dx, dz, mat));  // bottom
 
     return sides;
 }
\ No newline at end of file
@@ -33,4 +33,23 @@ public:
     {
         return orig + t * dir;
     }
-};
\ No newline at end of file
+};
+
+/**
+ * @brief a ray prepared for slab tests: componentwise 1 / direction, infinite for axis parallel
+ * directions, and the sign that selects the near plane of a slab. Made once where a traversal
+ * starts, so the rays that are only scattered, copied or tested against primitives never pay for it
+ */
+struct slab_ray
+{
+    point3 orig;
+    vec3 inv_dir;
+    int sign[3]; // 1 where inv_dir is negative
+
+    explicit slab_ray(const ray &r)
+        : orig(r.origin()), inv_dir(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z())
+    {
+        for (int a = 0; a < 3; a++)
+            sign[a] = inv_dir[a] < 0;
+    }
+};
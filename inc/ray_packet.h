@@ -0,0 +1,38 @@
+#pragma once
+
+#include "utils.h"
+#include "simd.h"
+
+constexpr int packet_size = 4;
+constexpr int packet_full_mask = (1 << packet_size) - 1;
+
+/**
+ * @brief packet of coherent rays stored as structure of arrays, so that a box or primitive
+ * can be tested against all lanes with one SIMD instruction per operation.
+ * Lanes outside the active mask of a query hold copies of lane 0
+ */
+struct ray_packet
+{
+    ray rays[packet_size];
+    alignas(32) double orig[3][packet_size];
+    alignas(32) double dir[3][packet_size];
+    alignas(32) double inv_dir[3][packet_size];
+    alignas(32) double time[packet_size];
+
+    void set(int lane, const ray &r)
+    {
+        rays[lane] = r;
+        for (int a = 0; a < 3; a++)
+        {
+            orig[a][lane] = r.origin()[a];
+            dir[a][lane] = r.direction()[a];
+            inv_dir[a][lane] = 1 / r.direction()[a];
+        }
+        time[lane] = r.time();
+    }
+
+    double4 origin(int axis) const { return double4::load(orig[axis]); }
+    double4 direction(int axis) const { return double4::load(dir[axis]); }
+    double4 inv_direction(int axis) const { return double4::load(inv_dir[axis]); }
+    double4 times() const { return double4::load(time); }
+};
\ No newline at end of file
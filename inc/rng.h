@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+
+// 64-bit finalizer of SplitMix64, used to decorrelate seeds
+inline uint64_t mix_bits(uint64_t v)
+{
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+/**
+ * @brief PCG32 generator (XSH-RR output, 64-bit LCG state), see https://www.pcg-random.org
+ * 16 bytes of state, cheap enough to live in thread local storage and to be reseeded per sample
+ */
+class pcg32
+{
+private:
+    static constexpr uint64_t multiplier = 6364136223846793005ULL;
+    static constexpr uint64_t default_state = 0x853c49e6748fea9bULL;
+    static constexpr uint64_t default_stream = 0xda3e39cb94b95bdbULL;
+
+    uint64_t state = default_state;
+    uint64_t inc = default_stream;
+
+public:
+    pcg32() = default;
+    pcg32(uint64_t seed, uint64_t stream = 1)
+    {
+        this->seed(seed, stream);
+    }
+
+    void seed(uint64_t seed, uint64_t stream = 1)
+    {
+        state = 0;
+        inc = (stream << 1) | 1;
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    uint32_t next_uint()
+    {
+        uint64_t old = state;
+        state = old * multiplier + inc;
+        auto xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        auto rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31));
+    }
+
+    // independent generator seeded from the next two outputs of this one
+    pcg32 split()
+    {
+        uint64_t hi = next_uint();
+        uint64_t lo = next_uint();
+        return pcg32(mix_bits(hi << 32 | lo), hi);
+    }
+
+    // uniform in [0, 1)
+    double next_double()
+    {
+        return next_uint() * 0x1p-32;
+    }
+};
+
+// Global seed of the render, change it to get a different but reproducible noise pattern
+inline uint64_t &render_seed()
+{
+    static uint64_t seed = 0;
+    return seed;
+}
+
+// Generator of the calling thread, no state is shared between threads
+inline pcg32 &thread_rng()
+{
+    thread_local pcg32 rng;
+    return rng;
+}
+
+/**
+ * @brief restart the calling thread's stream for one camera sample. The k-th number drawn
+ * afterwards only depends on (pixel, sample, k), so a render is reproducible no matter
+ * which thread traces which pixel
+ * @param pixel linear pixel index
+ * @param sample index of the sample inside the pixel
+ */
+inline void seed_sample(uint64_t pixel, uint64_t sample)
+{
+    auto key = mix_bits(render_seed() + pixel * 0x9e3779b97f4a7c15ULL);
+    thread_rng().seed(mix_bits(key ^ sample));
+}
\ No newline at end of file
@@ -0,0 +1,574 @@
+#pragma once
+
+#include "CImg.h"
+
+#include "utils.h"
+#include "affine.h"
+#include "arena.h"
+#include "bvh.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "film.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "mesh_io.h"
+#include "quad.h"
+#include "snapshot.h"
+#include "sphere.h"
+#include "texture.h"
+#include "wavefront.h"
+
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+
+enum class render_mode
+{
+    tile,        // one pass over the image tile by tile
+    wavefront,   // bounce by bounce with the stream engine
+    progressive, // passes accumulated in a film, optionally checkpointed
+};
+
+/**
+ * @brief camera, world and render settings of a scene, read from a text file.
+ *
+ * Every line holds one statement, '#' starts a comment. Names are defined before they are used.
+ * Numbers may be written as ratios (16/9), colors are three numbers, and where a texture is
+ * expected a color may be given instead.
+ *
+ *   camera KEY VALUE...           camera members by name: image_width, aspect_ratio, samples_per_row,
+ *                                 samples_per_subpixel, max_depth, vfov, lookfrom, lookat, vup,
+ *                                 defocus_angle, focus_dist, background, adaptive_threshold,
+ *                                 sample_lights (0 or 1), light_tree (0 picks lights uniformly)
+ *   render tile|wavefront|progressive [CHECKPOINT]
+ *   output FILE                   png written by render(), the scene name by default
+ *
+ *   texture NAME solid R G B | checker SCALE EVEN ODD | image FILE | noise FREQ [TURBULENCE [DEPTH]]
+ *   material NAME lambertian TEX | metal R G B FUZZ | dielectric IOR | light TEX | isotropic TEX
+ *
+ *   sphere MAT X Y Z RADIUS
+ *   moving_sphere MAT X0 Y0 Z0 X1 Y1 Z1 RADIUS
+ *   quad MAT QX QY QZ UX UY UZ VX VY VZ
+ *   box MAT X0 Y0 Z0 X1 Y1 Z1
+ *   mesh MAT FILE                 OBJ or binary PLY
+ *
+ *   translate X Y Z | scale X Y Z | rotate AX AY AZ DEGREES | rotate_y DEGREES
+ *                                 compose onto the current transform, which applies to everything
+ *                                 placed after it: the last one given is applied first
+ *   push | pop                    save and restore the current transform
+ *
+ *   object NAME ... end           collect the shapes in between into a named object (a BVH when
+ *                                 there are several) instead of adding them to the world
+ *   instance NAME                 place a named object with the current transform
+ *   medium NAME DENSITY TEX       constant density volume bounded by a named object
+ *
+ *   snapshot FILE                 before any shape: map the BVHs and meshes from FILE when it was
+ *                                 taken from this scene, otherwise build them and write FILE
+ *
+ * Relative file names are looked up next to the scene file first. The world is put in a BVH
+ */
+class scene
+{
+public:
+    shared_ptr<scene_arena> arena = scene_arena::create(); // the objects of the scene are made here
+    camera cam;
+    hittable_list world;
+    render_mode mode = render_mode::tile;
+    std::string checkpoint; // for render_mode::progressive, none when empty
+    uint64_t fingerprint = 0; // of the scene text, a checkpoint is only resumed by the same text
+    std::string output;
+
+    /**
+     * @return false if the file is missing or malformed, the reason is written to std::cerr
+     */
+    bool load(const std::string &path);
+
+    void render() const
+    {
+        cimg_library::CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
+        if (mode == render_mode::tile)
+            cam.render(image, world);
+        else
+        {
+            film accum(cam.image_width, cam.image_height);
+            if (mode == render_mode::wavefront)
+                wavefront_integrator(cam).render(accum, world);
+            else
+                cam.render_progressive(accum, world, checkpoint, fingerprint);
+            accum.resolve(image);
+        }
+        image.save_png(output.c_str());
+    }
+};
+
+/**
+ * @brief single pass parser of the scene format, reading the memory mapped file in place
+ */
+class scene_parser
+{
+private:
+    struct parse_error : std::runtime_error
+    {
+        using std::runtime_error::runtime_error;
+    };
+
+    scene &target;
+    std::string directory; // of the scene file, with a trailing separator
+    const char *p = nullptr, *end = nullptr;
+    int line = 1;
+
+    std::unordered_map<std::string, shared_ptr<texture>> textures;
+    std::unordered_map<std::string, shared_ptr<material>> materials;
+    std::unordered_map<std::string, shared_ptr<hittable>> objects;
+
+    affine transform;
+    bool transformed = false;
+    vector<std::pair<affine, bool>> saved;
+
+    hittable_list *shapes; // world, or the object being defined
+    hittable_list object_shapes;
+    std::string object_name;
+
+    std::string snapshot_path;
+    snapshot::reader snapshot_in;
+    snapshot::writer snapshot_out;
+    bool snapshot_stale = false; // something was built, the snapshot has to be written
+
+    static bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    void skip_blanks()
+    {
+        while (p < end && is_blank(*p))
+            p++;
+    }
+
+    bool at_line_end()
+    {
+        skip_blanks();
+        return p == end || *p == '\n' || *p == '#';
+    }
+
+    std::string_view word()
+    {
+        if (at_line_end())
+            throw parse_error("missing argument");
+        auto start = p;
+        while (p < end && !is_blank(*p) && *p != '\n' && *p != '#')
+            p++;
+        return std::string_view(start, p - start);
+    }
+
+    // whether the next argument is a number rather than a name
+    bool number_follows()
+    {
+        if (at_line_end())
+            return false;
+        return (*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.';
+    }
+
+    // a number, or a ratio such as 16/9
+    double number()
+    {
+        auto w = word();
+        auto last = w.data() + w.size();
+        double x, y;
+        auto res = std::from_chars(w.data() + (w[0] == '+' ? 1 : 0), last, x);
+        if (res.ec == std::errc() && res.ptr < last && *res.ptr == '/')
+        {
+            res = std::from_chars(res.ptr + 1, last, y);
+            x /= y;
+        }
+        if (res.ec != std::errc() || res.ptr != last)
+            throw parse_error("expected a number, got '" + std::string(w) + "'");
+        return x;
+    }
+
+    vec3 triple()
+    {
+        auto x = number();
+        auto y = number();
+        return vec3(x, y, number());
+    }
+
+    template <typename T>
+    const shared_ptr<T> &lookup(const std::unordered_map<std::string, shared_ptr<T>> &table, const char *kind)
+    {
+        auto name = word();
+        auto it = table.find(std::string(name));
+        if (it == table.end())
+            throw parse_error(std::string("unknown ") + kind + " '" + std::string(name) + "'");
+        return it->second;
+    }
+
+    shared_ptr<texture> texture_or_color()
+    {
+        if (number_follows())
+            return make<solid_color>(triple());
+        return lookup(textures, "texture");
+    }
+
+    // name taken relative to the directory of the scene file, absolute paths are left alone
+    std::string in_scene_directory(const std::string &name) const
+    {
+        if (name.empty() || directory.empty())
+            return name;
+        bool absolute = name[0] == '/' || name[0] == '\\' || (name.size() > 1 && name[1] == ':');
+        return absolute ? name : directory + name;
+    }
+
+    // an input file, next to the scene file if it is there, as given otherwise
+    std::string file_name()
+    {
+        std::string name(word());
+        auto local = in_scene_directory(name);
+        if (local == name)
+            return name;
+        std::ifstream in(local);
+        return in ? local : name;
+    }
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make(Args &&...args)
+    {
+        return target.arena->make<T>(std::forward<Args>(args)...);
+    }
+
+    // spheres and quads are copied into the BVH that holds them, so they are made on the heap where
+    // the originals go away with the list instead of staying behind in the arena
+    template <typename T, typename... Args>
+    shared_ptr<T> make_shape(Args &&...args)
+    {
+        return make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    // BVH over the list, from the snapshot when it has one
+    shared_ptr<bvh> make_bvh(const hittable_list &list)
+    {
+        shared_ptr<bvh> tree;
+        bvh_accel prebuilt;
+        if (snapshot_in.next_bvh(list.get_objects().size(), prebuilt))
+            tree = make<bvh>(list, std::move(prebuilt));
+        else
+        {
+            snapshot_mismatch();
+            tree = make<bvh>(list);
+        }
+        if (!snapshot_path.empty())
+            snapshot_out.add_bvh(tree->accelerator());
+        return tree;
+    }
+
+    shared_ptr<triangle_mesh> make_mesh(const std::string &path, const shared_ptr<material> &mat)
+    {
+        uint64_t size = 0;
+        int64_t time = 0;
+        std::error_code error;
+        if (!snapshot_path.empty())
+        {
+            size = std::filesystem::file_size(path, error);
+            time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        }
+
+        auto mesh = snapshot_in.next_mesh(size, time, mat, target.arena);
+        if (!mesh)
+        {
+            snapshot_mismatch();
+            mesh_data data;
+            if (!mesh_io::load(path, data))
+                throw parse_error("mesh could not be loaded");
+            mesh = make<triangle_mesh>(std::move(data), mat);
+        }
+        if (!snapshot_path.empty())
+            snapshot_out.add_mesh(*mesh, size, time);
+        return mesh;
+    }
+
+    // the rest is built and the snapshot rewritten
+    void snapshot_mismatch()
+    {
+        snapshot_in.close();
+        snapshot_stale = !snapshot_path.empty();
+    }
+
+    void add(shared_ptr<hittable> object)
+    {
+        if (transformed)
+            object = make<instance>(std::move(object), transform);
+        shapes->add(object);
+    }
+
+    void parse_camera()
+    {
+        auto &cam = target.cam;
+        while (!at_line_end())
+        {
+            auto key = word();
+            if (key == "image_width") cam.image_width = static_cast<int>(number());
+            else if (key == "aspect_ratio") cam.aspect_ratio = number();
+            else if (key == "samples_per_row") cam.samples_per_row = static_cast<int>(number());
+            else if (key == "samples_per_subpixel") cam.samples_per_subpixel = static_cast<int>(number());
+            else if (key == "max_depth") cam.max_depth = static_cast<int>(number());
+            else if (key == "vfov") cam.vfov = number();
+            else if (key == "lookfrom") cam.lookfrom = triple();
+            else if (key == "lookat") cam.lookat = triple();
+            else if (key == "vup") cam.vup = triple();
+            else if (key == "defocus_angle") cam.defocus_angle = number();
+            else if (key == "focus_dist") cam.focus_dist = number();
+            else if (key == "background") cam.background = triple();
+            else if (key == "adaptive_threshold") cam.adaptive_threshold = number();
+            else if (key == "sample_lights") cam.sample_lights = number() != 0;
+            else if (key == "light_tree") cam.light_tree = number() != 0;
+            else throw parse_error("unknown camera parameter '" + std::string(key) + "'");
+        }
+    }
+
+    void parse_texture()
+    {
+        std::string name(word());
+        auto kind = word();
+        shared_ptr<texture> tex;
+        if (kind == "solid")
+            tex = make<solid_color>(triple());
+        else if (kind == "checker")
+        {
+            auto scale = number();
+            auto even = texture_or_color();
+            tex = make<checker_texture>(scale, even, texture_or_color());
+        }
+        else if (kind == "image")
+            tex = make<image_texture>(file_name());
+        else if (kind == "noise")
+        {
+            auto freq = number();
+            auto turbulence = number_follows() ? number() : 10.0;
+            auto depth = number_follows() ? static_cast<int>(number()) : 7;
+            tex = make<noise_texture>(freq, turbulence, depth);
+        }
+        else
+            throw parse_error("unknown texture type '" + std::string(kind) + "'");
+        textures[name] = tex;
+    }
+
+    void parse_material()
+    {
+        std::string name(word());
+        auto kind = word();
+        shared_ptr<material> mat;
+        if (kind == "lambertian")
+            mat = make<lambertian>(texture_or_color());
+        else if (kind == "metal")
+        {
+            auto albedo = triple();
+            mat = make<metal>(albedo, number());
+        }
+        else if (kind == "dielectric")
+            mat = make<dielectric>(number());
+        else if (kind == "light")
+            mat = make<diffuse_light>(texture_or_color());
+        else if (kind == "isotropic")
+            mat = make<isotropic>(texture_or_color());
+        else
+            throw parse_error("unknown material type '" + std::string(kind) + "'");
+        materials[name] = mat;
+    }
+
+    void parse_statement(std::string_view keyword)
+    {
+        if (keyword == "sphere")
+        {
+            auto &mat = lookup(materials, "material");
+            auto center = triple();
+            add(make_shape<sphere>(center, number(), mat));
+        }
+        else if (keyword == "moving_sphere")
+        {
+            auto &mat = lookup(materials, "material");
+            auto center1 = triple();
+            auto center2 = triple();
+            add(make_shape<sphere>(center1, center2, number(), mat));
+        }
+        else if (keyword == "quad")
+        {
+            auto &mat = lookup(materials, "material");
+            auto q = triple();
+            auto u = triple();
+            add(make_shape<quad>(q, u, triple(), mat));
+        }
+        else if (keyword == "box")
+        {
+            auto &mat = lookup(materials, "material");
+            auto a = triple();
+            add(box(a, triple(), mat, target.arena));
+        }
+        else if (keyword == "mesh")
+        {
+            auto &mat = lookup(materials, "material");
+            add(make_mesh(file_name(), mat));
+        }
+        else if (keyword == "camera")
+            parse_camera();
+        else if (keyword == "texture")
+            parse_texture();
+        else if (keyword == "material")
+            parse_material();
+        else if (keyword == "translate")
+            compose(affine::translation(triple()));
+        else if (keyword == "scale")
+            compose(affine::scaling(triple()));
+        else if (keyword == "rotate")
+        {
+            auto axis = triple();
+            compose(affine::rotation(axis, number()));
+        }
+        else if (keyword == "rotate_y")
+            compose(affine::rotation_y(number()));
+        else if (keyword == "push")
+            saved.emplace_back(transform, transformed);
+        else if (keyword == "pop")
+        {
+            if (saved.empty())
+                throw parse_error("pop without push");
+            std::tie(transform, transformed) = saved.back();
+            saved.pop_back();
+        }
+        else if (keyword == "object")
+        {
+            if (shapes != &target.world)
+                throw parse_error("objects cannot be nested");
+            object_name = word();
+            shapes = &object_shapes;
+        }
+        else if (keyword == "end")
+        {
+            if (shapes == &target.world || object_shapes.get_objects().empty())
+                throw parse_error("end without a non empty object");
+            const auto &list = object_shapes.get_objects();
+            objects[object_name] = list.size() == 1 ? list[0] : make_bvh(object_shapes);
+            object_shapes = hittable_list();
+            shapes = &target.world;
+        }
+        else if (keyword == "instance")
+            add(lookup(objects, "object"));
+        else if (keyword == "medium")
+        {
+            auto boundary = lookup(objects, "object");
+            if (transformed)
+                boundary = make<instance>(boundary, transform);
+            auto density = number();
+            shapes->add(make<constant_medium>(boundary, density, texture_or_color()));
+        }
+        else if (keyword == "render")
+        {
+            auto mode = word();
+            if (mode == "tile") target.mode = render_mode::tile;
+            else if (mode == "wavefront") target.mode = render_mode::wavefront;
+            else if (mode == "progressive") target.mode = render_mode::progressive;
+            else throw parse_error("unknown render mode '" + std::string(mode) + "'");
+            if (target.mode == render_mode::progressive && !at_line_end())
+                target.checkpoint = word();
+        }
+        else if (keyword == "output")
+            target.output = word();
+        else if (keyword == "snapshot")
+        {
+            if (!target.world.get_objects().empty() || !objects.empty() || shapes != &target.world)
+                throw parse_error("snapshot has to come before the shapes");
+            snapshot_path = in_scene_directory(std::string(word()));
+            if (!snapshot_in.open(snapshot_path, target.fingerprint))
+                snapshot_stale = true;
+        }
+        else
+            throw parse_error("unknown statement '" + std::string(keyword) + "'");
+    }
+
+    void compose(const affine &t)
+    {
+        transform = transform * t;
+        transformed = true;
+    }
+
+public:
+    explicit scene_parser(scene &target) : target(target), shapes(&target.world) {}
+
+    bool parse(const std::string &path)
+    {
+        mapped_file file(path);
+        if (!file.is_open())
+        {
+            std::cerr << "scene " << path << ": cannot be opened" << std::endl;
+            return false;
+        }
+        auto slash = path.find_last_of("/\\");
+        directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+        p = file.data();
+        end = p + file.size();
+        target.fingerprint = hash_bytes(p, file.size());
+
+        try
+        {
+            while (p < end)
+            {
+                if (!at_line_end())
+                {
+                    parse_statement(word());
+                    if (!at_line_end())
+                        throw parse_error("unexpected '" + std::string(word()) + "'");
+                }
+                // skip the comment and the newline
+                while (p < end && *p != '\n')
+                    p++;
+                if (p < end)
+                {
+                    p++;
+                    line++;
+                }
+            }
+            if (shapes != &target.world)
+                throw parse_error("object '" + object_name + "' is not closed by end");
+            if (target.world.get_objects().empty())
+                throw parse_error("nothing to render");
+        }
+        catch (const parse_error &e)
+        {
+            std::cerr << "scene " << path << ":" << line << ": " << e.what() << std::endl;
+            return false;
+        }
+
+        auto tree = make_bvh(target.world);
+        tree->report(std::clog);
+        std::clog << "Scene objects: " << target.arena->bytes_used() / 1024.0 << " KiB in "
+                  << target.arena->bytes_reserved() / 1024.0 << " KiB of arena blocks" << std::endl;
+        target.world = hittable_list(tree);
+
+        if (snapshot_stale)
+        {
+            if (snapshot_out.save(snapshot_path, target.fingerprint))
+                std::clog << "Wrote snapshot " << snapshot_path << std::endl;
+            else
+                std::cerr << "snapshot " << snapshot_path << ": cannot be written" << std::endl;
+        }
+        return true;
+    }
+};
+
+inline bool scene::load(const std::string &path)
+{
+    if (!scene_parser(*this).parse(path))
+        return false;
+    if (output.empty())
+    {
+        auto slash = path.find_last_of("/\\");
+        auto name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+        output = name.substr(0, name.find_last_of('.')) + ".png";
+    }
+    cam.initialize();
+    return true;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1)
+struct tile
+{
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int area() const { return width() * height(); }
+};
+
+// interleave the lower 16 bits of x and y: ...y1x1y0x0
+inline uint32_t morton_code(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint32_t v)
+    {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+/**
+ * @brief split the image into square tiles, ordered along a Morton (Z-order) curve
+ * so that consecutive tiles are spatially close
+ */
+inline std::vector<tile> make_tiles(int width, int height, int tile_size)
+{
+    std::vector<tile> tiles;
+    std::vector<uint32_t> codes;
+    int n_x = (width + tile_size - 1) / tile_size;
+    int n_y = (height + tile_size - 1) / tile_size;
+    for (int ty = 0; ty < n_y; ty++)
+        for (int tx = 0; tx < n_x; tx++)
+        {
+            tiles.push_back({tx * tile_size, ty * tile_size,
+                             std::min((tx + 1) * tile_size, width),
+                             std::min((ty + 1) * tile_size, height)});
+            codes.push_back(morton_code(tx, ty));
+        }
+
+    std::vector<size_t> order(tiles.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return codes[a] < codes[b]; });
+
+    std::vector<tile> sorted;
+    sorted.reserve(tiles.size());
+    for (auto i : order)
+        sorted.push_back(tiles[i]);
+    return sorted;
+}
+
+/**
+ * @brief hands out tiles to workers. Every worker owns a deque seeded with a contiguous
+ * run of the tile list; it pops from the front of its own deque and, once empty, steals
+ * from the back of the others.
+ */
+class tile_scheduler
+{
+private:
+    struct worker_queue
+    {
+        std::mutex lock;
+        std::deque<tile> tiles;
+    };
+
+    std::vector<worker_queue> queues;
+
+public:
+    tile_scheduler(const std::vector<tile> &tiles, int n_workers)
+        : queues(n_workers)
+    {
+        size_t n = tiles.size();
+        for (int w = 0; w < n_workers; w++)
+        {
+            size_t begin = n * w / n_workers;
+            size_t end = n * (w + 1) / n_workers;
+            queues[w].tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+        }
+    }
+
+    /**
+     * @brief fetch the next tile for worker id
+     * @return false if there is no work left anywhere
+     */
+    bool next(int id, tile &t)
+    {
+        {
+            auto &own = queues[id];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tiles.empty())
+            {
+                t = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+        // steal from the back, far away from where the victim is working
+        int n = static_cast<int>(queues.size());
+        for (int k = 1; k < n; k++)
+        {
+            auto &victim = queues[(id + k) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty())
+            {
+                t = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
\ No newline at end of file
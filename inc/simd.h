@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cmath>
+
+// define RT_NO_SIMD to force the portable fallback
+#if defined(RT_NO_SIMD)
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define RT_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RT_SIMD_SSE2
+#endif
+
+/**
+ * @brief 4 doubles processed together. Maps to one AVX register, two SSE2 registers,
+ * or a plain array on other targets. Comparisons return lane masks with all bits set
+ */
+struct alignas(32) double4
+{
+#if defined(RT_SIMD_AVX)
+    __m256d v;
+
+    double4() = default;
+    double4(__m256d v) : v(v) {}
+    double4(double x) : v(_mm256_set1_pd(x)) {}
+
+    static double4 load(const double *p) { return _mm256_loadu_pd(p); }
+    static double4 load(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+    void store(double *p) const { _mm256_storeu_pd(p, v); }
+
+    friend double4 operator+(double4 a, double4 b) { return _mm256_add_pd(a.v, b.v); }
+    friend double4 operator-(double4 a, double4 b) { return _mm256_sub_pd(a.v, b.v); }
+    friend double4 operator*(double4 a, double4 b) { return _mm256_mul_pd(a.v, b.v); }
+    friend double4 operator/(double4 a, double4 b) { return _mm256_div_pd(a.v, b.v); }
+    friend double4 operator<(double4 a, double4 b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+    friend double4 operator<=(double4 a, double4 b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+    friend double4 operator&(double4 a, double4 b) { return _mm256_and_pd(a.v, b.v); }
+    friend double4 operator|(double4 a, double4 b) { return _mm256_or_pd(a.v, b.v); }
+    friend double4 min(double4 a, double4 b) { return _mm256_min_pd(a.v, b.v); }
+    friend double4 max(double4 a, double4 b) { return _mm256_max_pd(a.v, b.v); }
+    friend double4 sqrt(double4 a) { return _mm256_sqrt_pd(a.v); }
+    // lanes of mask taken from a, the others from b
+    friend double4 select(double4 mask, double4 a, double4 b) { return _mm256_blendv_pd(b.v, a.v, mask.v); }
+    friend int movemask(double4 mask) { return _mm256_movemask_pd(mask.v); }
+#elif defined(RT_SIMD_SSE2)
+    __m128d lo, hi;
+
+    double4() = default;
+    double4(__m128d lo, __m128d hi) : lo(lo), hi(hi) {}
+    double4(double x) : lo(_mm_set1_pd(x)), hi(_mm_set1_pd(x)) {}
+
+    static double4 load(const double *p) { return double4(_mm_loadu_pd(p), _mm_loadu_pd(p + 2)); }
+    static double4 load(const float *p)
+    {
+        auto f = _mm_loadu_ps(p);
+        return double4(_mm_cvtps_pd(f), _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+    }
+    void store(double *p) const
+    {
+        _mm_storeu_pd(p, lo);
+        _mm_storeu_pd(p + 2, hi);
+    }
+
+    friend double4 operator+(double4 a, double4 b) { return double4(_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)); }
+    friend double4 operator-(double4 a, double4 b) { return double4(_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)); }
+    friend double4 operator*(double4 a, double4 b) { return double4(_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)); }
+    friend double4 operator/(double4 a, double4 b) { return double4(_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)); }
+    friend double4 operator<(double4 a, double4 b) { return double4(_mm_cmplt_pd(a.lo, b.lo), _mm_cmplt_pd(a.hi, b.hi)); }
+    friend double4 operator<=(double4 a, double4 b) { return double4(_mm_cmple_pd(a.lo, b.lo), _mm_cmple_pd(a.hi, b.hi)); }
+    friend double4 operator&(double4 a, double4 b) { return double4(_mm_and_pd(a.lo, b.lo), _mm_and_pd(a.hi, b.hi)); }
+    friend double4 operator|(double4 a, double4 b) { return double4(_mm_or_pd(a.lo, b.lo), _mm_or_pd(a.hi, b.hi)); }
+    friend double4 min(double4 a, double4 b) { return double4(_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)); }
+    friend double4 max(double4 a, double4 b) { return double4(_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)); }
+    friend double4 sqrt(double4 a) { return double4(_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)); }
+    friend double4 select(double4 mask, double4 a, double4 b)
+    {
+        return double4(_mm_or_pd(_mm_and_pd(mask.lo, a.lo), _mm_andnot_pd(mask.lo, b.lo)),
+                       _mm_or_pd(_mm_and_pd(mask.hi, a.hi), _mm_andnot_pd(mask.hi, b.hi)));
+    }
+    friend int movemask(double4 mask) { return _mm_movemask_pd(mask.lo) | (_mm_movemask_pd(mask.hi) << 2); }
+#else
+    double e[4];
+
+    double4() = default;
+    double4(double x) : e{x, x, x, x} {}
+
+    static double4 load(const double *p) { return map([&](int i) { return p[i]; }); }
+    static double4 load(const float *p) { return map([&](int i) { return static_cast<double>(p[i]); }); }
+    void store(double *p) const
+    {
+        for (int i = 0; i < 4; i++)
+            p[i] = e[i];
+    }
+
+    friend double4 operator+(double4 a, double4 b) { return map([&](int i) { return a.e[i] + b.e[i]; }); }
+    friend double4 operator-(double4 a, double4 b) { return map([&](int i) { return a.e[i] - b.e[i]; }); }
+    friend double4 operator*(double4 a, double4 b) { return map([&](int i) { return a.e[i] * b.e[i]; }); }
+    friend double4 operator/(double4 a, double4 b) { return map([&](int i) { return a.e[i] / b.e[i]; }); }
+    friend double4 operator<(double4 a, double4 b) { return map([&](int i) { return mask_of(a.e[i] < b.e[i]); }); }
+    friend double4 operator<=(double4 a, double4 b) { return map([&](int i) { return mask_of(a.e[i] <= b.e[i]); }); }
+    friend double4 operator&(double4 a, double4 b) { return map([&](int i) { return mask_of(is_set(a.e[i]) && is_set(b.e[i])); }); }
+    friend double4 operator|(double4 a, double4 b) { return map([&](int i) { return mask_of(is_set(a.e[i]) || is_set(b.e[i])); }); }
+    // same argument order semantics as SSE: the second operand wins if either is NaN
+    friend double4 min(double4 a, double4 b) { return map([&](int i) { return a.e[i] < b.e[i] ? a.e[i] : b.e[i]; }); }
+    friend double4 max(double4 a, double4 b) { return map([&](int i) { return a.e[i] > b.e[i] ? a.e[i] : b.e[i]; }); }
+    friend double4 sqrt(double4 a) { return map([&](int i) { return std::sqrt(a.e[i]); }); }
+    friend double4 select(double4 mask, double4 a, double4 b) { return map([&](int i) { return is_set(mask.e[i]) ? a.e[i] : b.e[i]; }); }
+    friend int movemask(double4 mask)
+    {
+        int m = 0;
+        for (int i = 0; i < 4; i++)
+            m |= is_set(mask.e[i]) << i;
+        return m;
+    }
+
+private:
+    template <typename F>
+    static double4 map(F &&f)
+    {
+        double4 r;
+        for (int i = 0; i < 4; i++)
+            r.e[i] = f(i);
+        return r;
+    }
+    // masks are stored as 1.0 / 0.0
+    static double mask_of(bool b) { return b ? 1.0 : 0.0; }
+    static bool is_set(double m) { return m != 0.0; }
+#endif
+};
\ No newline at end of file
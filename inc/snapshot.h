@@ -0,0 +1,299 @@
+#pragma once
+
+#include "utils.h"
+#include "arena.h"
+#include "bvh.h"
+#include "file_utils.h"
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+
+/**
+ * @brief binary snapshot of the parts of a scene that are expensive to rebuild: BVH nodes and mesh
+ * buffers, stored as sections in the order the scene creates them. Later runs map the file read
+ * only and use the nodes and buffers in place, so loading costs no build and no copies, and
+ * processes rendering the same scene share its pages through the page cache.
+ *
+ * Arrays start at 64 byte offsets so the nodes keep their alignment in the mapping. The file holds
+ * raw structures: it is only valid for builds with the same node layout, which the header records.
+ * Opening checks the header and the file size, and every section is checked against the bounds of
+ * the file, but the nodes and indices are used as written: walking them would page in the whole
+ * mapping before the first ray. The file is written whole or not at all, see writer::save()
+ */
+namespace snapshot
+{
+    constexpr char magic[8] = {'R', 'T', 'S', 'N', 'A', 'P', '0', '2'};
+    constexpr size_t alignment = 64;
+
+    enum class section_tag : uint32_t
+    {
+        bvh = 1,  // bvh_record, nodes, primitive order
+        mesh = 2, // mesh_record, positions, normals, uvs, indices, then a bvh section
+    };
+
+    struct file_header
+    {
+        char magic[8];
+        uint32_t node_size;
+        uint32_t width;
+        uint64_t fingerprint; // of the scene the snapshot was taken from
+        uint64_t file_size;   // a shorter file was cut off
+    };
+
+    // bytes from offset to the next 64 byte boundary
+    inline size_t padding(size_t offset)
+    {
+        return (alignment - offset % alignment) % alignment;
+    }
+
+    struct section_header
+    {
+        section_tag tag;
+        uint32_t reserved;
+    };
+
+    struct bvh_record
+    {
+        uint64_t primitives;
+        uint64_t nodes;
+        bvh_stats stats;
+    };
+
+    struct mesh_record
+    {
+        uint64_t source_size; // of the mesh file, to notice when it changes
+        int64_t source_time;
+        uint64_t vertices;
+        uint64_t triangles;
+        uint32_t has_normals;
+        uint32_t has_uvs;
+    };
+
+    /**
+     * @brief collects the sections while a scene is created and writes them in one go. Only
+     * pointers are kept, the data must stay alive until save()
+     */
+    class writer
+    {
+    private:
+        struct block
+        {
+            const void *data;
+            size_t size;
+        };
+        vector<block> blocks; // each starts at a 64 byte offset
+        vector<std::unique_ptr<char[]>> records; // copies of the small headers
+
+        template <typename T>
+        void record(const T &value)
+        {
+            records.emplace_back(new char[sizeof(T)]);
+            memcpy(records.back().get(), &value, sizeof(T));
+            blocks.push_back({records.back().get(), sizeof(T)});
+        }
+
+        void array(const void *data, size_t size)
+        {
+            blocks.push_back({data, size});
+        }
+
+    public:
+        void add_bvh(const bvh_accel &accel)
+        {
+            record(section_header{section_tag::bvh, 0});
+            record(bvh_record{accel.primitive_order().size(), accel.node_count(), accel.stats()});
+            array(accel.node_array(), accel.node_count() * sizeof(wide_bvh_node));
+            array(accel.primitive_order().data(), accel.primitive_order().size() * sizeof(uint32_t));
+        }
+
+        void add_mesh(const triangle_mesh &mesh, uint64_t source_size, int64_t source_time)
+        {
+            const auto &view = mesh.buffers();
+            record(section_header{section_tag::mesh, 0});
+            record(mesh_record{source_size, source_time, view.vertex_count, view.triangle_count,
+                               view.normals ? 1u : 0u, view.uvs ? 1u : 0u});
+            array(view.positions, view.vertex_count * 3 * sizeof(float));
+            if (view.normals)
+                array(view.normals, view.vertex_count * 3 * sizeof(float));
+            if (view.uvs)
+                array(view.uvs, view.vertex_count * 2 * sizeof(float));
+            array(view.indices, view.triangle_count * 3 * sizeof(uint32_t));
+            // the triangles are in leaf order already, the primitive order is not needed
+            record(section_header{section_tag::bvh, 0});
+            const auto &accel = mesh.accelerator();
+            record(bvh_record{0, accel.node_count(), accel.stats()});
+            array(accel.node_array(), accel.node_count() * sizeof(wide_bvh_node));
+        }
+
+        // written to a temporary file first, so a mapped older snapshot stays intact until replaced
+        bool save(const std::string &path, uint64_t fingerprint) const
+        {
+            auto tmp_path = path + ".tmp";
+            {
+                std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+                if (!out)
+                    return false;
+                file_header header;
+                memcpy(header.magic, magic, sizeof(magic));
+                header.node_size = sizeof(wide_bvh_node);
+                header.width = bvh_width;
+                header.fingerprint = fingerprint;
+                header.file_size = sizeof(header);
+                for (const auto &b : blocks)
+                    header.file_size += padding(header.file_size) + b.size;
+                out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                size_t offset = sizeof(header);
+                static const char zeros[alignment] = {};
+                for (const auto &b : blocks)
+                {
+                    auto pad = padding(offset);
+                    out.write(zeros, pad);
+                    out.write(static_cast<const char *>(b.data), b.size);
+                    offset += pad + b.size;
+                }
+                if (!out)
+                    return false;
+            }
+            return replace_file(tmp_path, path);
+        }
+    };
+
+    /**
+     * @brief hands out the sections of a mapped snapshot in order. Every read checks that the
+     * section matches what the scene asks for, a mismatch means the snapshot is stale
+     */
+    class reader
+    {
+    private:
+        shared_ptr<mapped_file> file;
+        size_t offset = 0;
+
+        // next 64 byte aligned block of size bytes, null past the end
+        const char *take(size_t size)
+        {
+            offset += padding(offset);
+            if (!file || offset > file->size() || size > file->size() - offset)
+                return nullptr;
+            auto p = file->data() + offset;
+            offset += size;
+            return p;
+        }
+
+        // next block as count values of T, null past the end or if the size overflows
+        template <typename T>
+        const T *take_array(uint64_t count)
+        {
+            if (count > std::numeric_limits<size_t>::max() / sizeof(T))
+                return nullptr;
+            return reinterpret_cast<const T *>(take(static_cast<size_t>(count) * sizeof(T)));
+        }
+
+        template <typename T>
+        bool read(T &value)
+        {
+            auto p = take(sizeof(T));
+            if (p)
+                memcpy(&value, p, sizeof(T));
+            return p != nullptr;
+        }
+
+        bool expect(section_tag tag)
+        {
+            section_header header;
+            return read(header) && header.tag == tag;
+        }
+
+        /**
+         * @param primitives length of the primitive order, 0 if the primitives are stored in leaf order
+         */
+        bool read_bvh(size_t primitives, bvh_accel &accel)
+        {
+            bvh_record rec;
+            if (!expect(section_tag::bvh) || !read(rec) || rec.primitives != primitives)
+                return false;
+            auto nodes = take_array<wide_bvh_node>(rec.nodes);
+            auto order = take_array<uint32_t>(rec.primitives);
+            if (!nodes || !order)
+                return false;
+            // the order is copied anyway, checking it on the way costs nothing
+            vector<uint32_t> primitive_order(primitives);
+            for (size_t i = 0; i < primitives; i++)
+            {
+                if (order[i] >= primitives)
+                    return false;
+                primitive_order[i] = order[i];
+            }
+            accel.adopt(nodes, rec.nodes, std::move(primitive_order), rec.stats, file);
+            return true;
+        }
+
+    public:
+        /**
+         * @return false if the file is missing, cut off, of another node layout or taken from another scene
+         */
+        bool open(const std::string &path, uint64_t fingerprint)
+        {
+            file = make_shared<mapped_file>(path);
+            offset = 0;
+            file_header header;
+            if (!file->is_open() || !read(header) || memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+                header.node_size != sizeof(wide_bvh_node) || header.width != bvh_width || header.fingerprint != fingerprint ||
+                header.file_size != file->size())
+            {
+                file.reset();
+                return false;
+            }
+            return true;
+        }
+
+        bool is_open() const { return file != nullptr; }
+
+        // stop reading, what was handed out stays valid
+        void close() { file.reset(); }
+
+        /**
+         * @brief next section as the tree of a BVH over the given number of primitives
+         * @return false if the next section is something else
+         */
+        bool next_bvh(size_t primitives, bvh_accel &accel)
+        {
+            return file && read_bvh(primitives, accel);
+        }
+
+        /**
+         * @brief next section as a mesh loaded from a file of the given size and modification time,
+         * made in arena
+         * @return null if the next section is something else, or was taken from an older mesh file
+         */
+        shared_ptr<triangle_mesh> next_mesh(uint64_t source_size, int64_t source_time, shared_ptr<material> mat,
+                                            const shared_ptr<scene_arena> &arena)
+        {
+            mesh_record rec;
+            if (!file || !expect(section_tag::mesh) || !read(rec) || rec.source_size != source_size ||
+                rec.source_time != source_time)
+                return nullptr;
+            mesh_view view;
+            view.vertex_count = rec.vertices;
+            view.triangle_count = rec.triangles;
+            constexpr auto max_index = std::numeric_limits<uint32_t>::max();
+            if (rec.vertices > max_index || rec.triangles > max_index)
+                return nullptr;
+            view.positions = take_array<float>(rec.vertices * 3);
+            if (rec.has_normals)
+                view.normals = take_array<float>(rec.vertices * 3);
+            if (rec.has_uvs)
+                view.uvs = take_array<float>(rec.vertices * 2);
+            view.indices = take_array<uint32_t>(rec.triangles * 3);
+            bvh_accel accel;
+            if (!view.positions || (rec.has_normals && !view.normals) || (rec.has_uvs && !view.uvs) ||
+                !view.indices || !read_bvh(0, accel))
+                return nullptr;
+            return make_in<triangle_mesh>(arena, view, std::move(accel), std::move(mat), file);
+        }
+    };
+}
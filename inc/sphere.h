@@ -1,16 +1,18 @@
 #pragma once
 
 #include "hittable.h"
+#include "material.h"
 
-class sphere: public hittable
+class sphere final : public hittable
 {
 private:
+    friend class light_list;
+
     point3 center1;
     vec3 center_vec;
     double radius;
     shared_ptr<material> mat;
     bool is_moving;
-    aabb bbox;
 
     point3 center(double time) const noexcept
     {
@@ -33,27 +35,21 @@ private:
         v = theta * inv_pi;
     }
 
-public:
-    // stationary sphere
-    sphere(point3 center1, double radius, shared_ptr<material> mat)
-    : center1(center1), radius(radius), mat(mat), is_moving(false)
+    // traversal part of a hit, the surface is filled in by set_surface() for the closest one
+    void set_hit_record(double root, hit_record &rec) const
     {
-        auto rvec = vec3(radius, radius, radius);
-        bbox = aabb(center1 - rvec, center1 + rvec);
-    }
-    // moving sphere
-    sphere(point3 center1, point3 center2, double radius, shared_ptr<material> mat)
-    : center1(center1), radius(radius), mat(mat), is_moving(true)
-    {
-        auto rvec = vec3(radius, radius, radius);
-        aabb box1 = aabb(center1 - rvec, center1 + rvec);
-        aabb box2 = aabb(center2 - rvec, center2 + rvec);
-        bbox = aabb(box1, box2);
-        center_vec = center2 - center1;
+        rec.t = root;
+        rec.mat = mat.get();
+        rec.object = this;
+        rec.primitive = 0;
     }
-    bool hit(const ray &ray, interval ray_t, hit_record &rec) const override
+
+    /**
+     * @brief nearest root of the ray / sphere quadratic within ray_t
+     * @return false if the ray misses the sphere inside ray_t
+     */
+    bool nearest_root(const ray &ray, interval ray_t, const point3 &center, double &root) const
     {
-        point3 center = is_moving ? this->center(ray.time()) : center1;
         auto oc = ray.origin() - center;
         double a = dot(ray.direction(), ray.direction());
         // double b = 2 * dot(ray.direction(), oc);
@@ -63,24 +59,98 @@ public:
         if (delta < 0.0)
             return false;
         double sqrt_delta = sqrt(delta);
-        auto root = (-h - sqrt_delta) / a;
+        root = (-h - sqrt_delta) / a;
         if (!ray_t.surrounds(root))
         {
             root = (-h + sqrt_delta) / a;
             if (!ray_t.surrounds(root))
                 return false;
         }
-        rec.p = ray.at(root);
-        auto outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(ray, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.t = root;
-        rec.mat = mat;
         return true;
     }
 
-    aabb bounding_box() const
+public:
+    // stationary sphere
+    sphere(point3 center1, double radius, shared_ptr<material> mat)
+    : center1(center1), radius(radius), mat(mat), is_moving(false)
     {
-        return bbox;
+    }
+    // moving sphere
+    sphere(point3 center1, point3 center2, double radius, shared_ptr<material> mat)
+    : center1(center1), center_vec(center2 - center1), radius(radius), mat(mat), is_moving(true)
+    {
+    }
+    bool hit(const ray &ray, interval ray_t, hit_record &rec) const override
+    {
+        double root;
+        if (!nearest_root(ray, ray_t, is_moving ? center(ray.time()) : center1, root))
+            return false;
+        set_hit_record(root, rec);
+        return true;
+    }
+
+    void set_surface(const ray &ray, hit_record &rec) const override
+    {
+        rec.p = ray.at(rec.t);
+        auto outward_normal = (rec.p - (is_moving ? center(ray.time()) : center1)) / radius;
+        rec.set_face_normal(ray, outward_normal);
+        // the inverse trigonometry is only worth it for materials that look up a texture
+        if (mat->needs_uv())
+            get_sphere_uv(outward_normal, rec.u, rec.v);
+    }
+
+    bool occluded(const ray &ray, interval ray_t) const override
+    {
+        double root;
+        return nearest_root(ray, ray_t, is_moving ? center(ray.time()) : center1, root);
+    }
+
+    int hit_packet(const ray_packet &rays, int mask, double t_min, double *t_max, hit_record *recs) const override
+    {
+        double4 cx(center1.x()), cy(center1.y()), cz(center1.z());
+        if (is_moving)
+        {
+            auto time = rays.times();
+            cx = cx + time * double4(center_vec.x());
+            cy = cy + time * double4(center_vec.y());
+            cz = cz + time * double4(center_vec.z());
+        }
+        auto ocx = rays.origin(0) - cx, ocy = rays.origin(1) - cy, ocz = rays.origin(2) - cz;
+        auto dx = rays.direction(0), dy = rays.direction(1), dz = rays.direction(2);
+        auto a = dx * dx + dy * dy + dz * dz;
+        auto h = dx * ocx + dy * ocy + dz * ocz;
+        auto c = ocx * ocx + ocy * ocy + ocz * ocz - double4(radius * radius);
+        auto delta = h * h - a * c;
+        auto sqrt_delta = sqrt(max(delta, double4(0.0)));
+
+        double4 lo(t_min), hi = double4::load(t_max);
+        auto near_root = (double4(0.0) - h - sqrt_delta) / a;
+        auto far_root = (sqrt_delta - h) / a;
+        auto near_ok = (lo < near_root) & (near_root < hi);
+        auto root = select(near_ok, near_root, far_root);
+        auto ok = (double4(0.0) <= delta) & (lo < root) & (root < hi);
+
+        int hits = movemask(ok) & mask;
+        if (!hits)
+            return 0;
+        alignas(32) double roots[packet_size];
+        root.store(roots);
+        for (int l = 0; l < packet_size; l++)
+            if (hits >> l & 1)
+            {
+                set_hit_record(roots[l], recs[l]);
+                t_max[l] = roots[l];
+            }
+        return hits;
+    }
+
+    // computed on demand rather than stored, spheres are copied into the leaves of a bvh
+    aabb bounding_box() const override
+    {
+        auto rvec = vec3(radius, radius, radius);
+        aabb box(center1 - rvec, center1 + rvec);
+        if (is_moving)
+            box = aabb(box, aabb(center1 + center_vec - rvec, center1 + center_vec + rvec));
+        return box;
     }
 };
\ No newline at end of file
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "utils.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "material.h"
+
+#include <cstdint>
+
+/**
+ * @brief vertex and index buffers of a triangle mesh, as filled by the loaders in mesh_io.h.
+ * Attributes are stored in single precision, normals and uvs are either empty or given per vertex
+ */
+struct mesh_data
+{
+    vector<float> positions;  // xyz per vertex
+    vector<float> normals;    // xyz per vertex
+    vector<float> uvs;        // uv per vertex
+    vector<uint32_t> indices; // three vertices per triangle, counter-clockwise seen from the front
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+// the buffers of a mesh_data wherever they are stored, normals and uvs are null when absent
+struct mesh_view
+{
+    const float *positions = nullptr;
+    const float *normals = nullptr;
+    const float *uvs = nullptr;
+    const uint32_t *indices = nullptr;
+    size_t vertex_count = 0;
+    size_t triangle_count = 0;
+};
+
+/**
+ * @brief triangles sharing one vertex and index buffer, intersected through a BVH of their own.
+ * There is no object per triangle: the BVH leaves index the triangles, which are stored in leaf order.
+ * The buffers are either owned or read in place from a snapshot
+ */
+class triangle_mesh : public hittable
+{
+private:
+    mesh_data owned;
+    mesh_view mesh;
+    shared_ptr<const void> backing; // keeps snapshot buffers alive
+    shared_ptr<material> mat;
+    bvh_accel accel;
+    aabb bbox;
+
+    point3 vertex(uint32_t i) const
+    {
+        const float *p = &mesh.positions[3 * i];
+        return point3(p[0], p[1], p[2]);
+    }
+
+    /**
+     * @brief Moller-Trumbore ray/triangle intersection
+     * @param t returned hit distance, within ray_t
+     * @param b1 returned barycentric weight of the second vertex
+     * @param b2 returned barycentric weight of the third vertex
+     */
+    bool intersect(const ray &r, uint32_t tri, interval ray_t, double &t, double &b1, double &b2) const
+    {
+        const uint32_t *idx = &mesh.indices[3 * tri];
+        auto p0 = vertex(idx[0]);
+        auto e1 = vertex(idx[1]) - p0;
+        auto e2 = vertex(idx[2]) - p0;
+
+        auto pvec = cross(r.direction(), e2);
+        auto det = dot(e1, pvec);
+        // ray is parallel to the triangle, or the triangle is degenerate
+        if (det == 0)
+            return false;
+        auto inv_det = 1 / det;
+
+        auto s = r.origin() - p0;
+        b1 = dot(s, pvec) * inv_det;
+        if (b1 < 0 || b1 > 1)
+            return false;
+
+        auto q = cross(s, e1);
+        b2 = dot(r.direction(), q) * inv_det;
+        if (b2 < 0 || b1 + b2 > 1)
+            return false;
+
+        t = dot(e2, q) * inv_det;
+        return ray_t.contains(t);
+    }
+
+public:
+    triangle_mesh(mesh_data data, shared_ptr<material> m, const bvh_build_options &options = {})
+        : owned(std::move(data)), mat(std::move(m))
+    {
+        auto n = owned.triangle_count();
+        mesh.positions = owned.positions.data();
+        mesh.indices = owned.indices.data();
+        mesh.vertex_count = owned.vertex_count();
+        mesh.triangle_count = n;
+        vector<aabb> bounds(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            const uint32_t *idx = &mesh.indices[3 * i];
+            bounds[i] = aabb(aabb(vertex(idx[0]), vertex(idx[1])), aabb(vertex(idx[2]), vertex(idx[2]))).pad();
+            bbox = aabb(bbox, bounds[i]);
+        }
+        accel.build(bounds, options);
+
+        // store the triangles in leaf order, so leaf ranges index them directly
+        vector<uint32_t> sorted(owned.indices.size());
+        const auto &order = accel.primitive_order();
+        for (size_t i = 0; i < n; i++)
+            for (int k = 0; k < 3; k++)
+                sorted[3 * i + k] = owned.indices[3 * order[i] + k];
+        owned.indices = std::move(sorted);
+        mesh.indices = owned.indices.data();
+        mesh.normals = owned.normals.empty() ? nullptr : owned.normals.data();
+        mesh.uvs = owned.uvs.empty() ? nullptr : owned.uvs.data();
+    }
+
+    /**
+     * @brief mesh over buffers stored elsewhere, with the triangles already in the leaf order of accel
+     * @param backing keeps the buffers alive
+     */
+    triangle_mesh(const mesh_view &buffers, bvh_accel prebuilt, shared_ptr<material> m, shared_ptr<const void> backing)
+        : mesh(buffers), backing(std::move(backing)), mat(std::move(m)), accel(std::move(prebuilt))
+    {
+        // reading every vertex would page in the whole mesh, the root bounds are enough
+        bbox = accel.bounds();
+    }
+
+    // the views point into the mesh itself
+    triangle_mesh(const triangle_mesh &) = delete;
+    triangle_mesh &operator=(const triangle_mesh &) = delete;
+
+    size_t triangle_count() const { return mesh.triangle_count; }
+    const mesh_view &buffers() const { return mesh; }
+    const bvh_accel &accelerator() const { return accel; }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        bool hit_anything = accel.traverse(r, ray_t, [&](uint32_t first, uint32_t count, interval &ray_t)
+        {
+            bool hit_leaf = false;
+            double t, b1, b2;
+            for (auto i = first; i < first + count; i++)
+                if (intersect(r, i, ray_t, t, b1, b2))
+                {
+                    hit_leaf = true;
+                    ray_t.max = t;
+                    rec.t = t;
+                    rec.primitive = i;
+                }
+            return hit_leaf;
+        });
+        if (!hit_anything)
+            return false;
+        rec.mat = mat.get();
+        rec.object = this;
+        return true;
+    }
+
+    void set_surface(const ray &r, hit_record &rec) const override
+    {
+        // recover the barycentrics of the closest triangle instead of carrying them through traversal
+        double t, b1, b2;
+        intersect(r, rec.primitive, interval::universe, t, b1, b2);
+        auto b0 = 1 - b1 - b2;
+
+        const uint32_t *idx = &mesh.indices[3 * rec.primitive];
+        auto p0 = vertex(idx[0]);
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit(cross(vertex(idx[1]) - p0, vertex(idx[2]) - p0)));
+
+        // interpolated normals only shade, the side is decided by the geometric normal
+        if (mesh.normals)
+        {
+            const float *n0 = &mesh.normals[3 * idx[0]], *n1 = &mesh.normals[3 * idx[1]], *n2 = &mesh.normals[3 * idx[2]];
+            auto shading = unit(vec3(b0 * n0[0] + b1 * n1[0] + b2 * n2[0],
+                                     b0 * n0[1] + b1 * n1[1] + b2 * n2[1],
+                                     b0 * n0[2] + b1 * n1[2] + b2 * n2[2]));
+            rec.normal = rec.front_face ? shading : -shading;
+        }
+
+        if (!rec.mat->needs_uv())
+            return;
+        if (!mesh.uvs)
+        {
+            rec.u = b1;
+            rec.v = b2;
+            return;
+        }
+        const float *uv0 = &mesh.uvs[2 * idx[0]], *uv1 = &mesh.uvs[2 * idx[1]], *uv2 = &mesh.uvs[2 * idx[2]];
+        rec.u = b0 * uv0[0] + b1 * uv1[0] + b2 * uv2[0];
+        rec.v = b0 * uv0[1] + b1 * uv1[1] + b2 * uv2[1];
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        return accel.traverse_any(r, ray_t, [&](uint32_t first, uint32_t count)
+        {
+            double t, b1, b2;
+            for (auto i = first; i < first + count; i++)
+                if (intersect(r, i, ray_t, t, b1, b2))
+                    return true;
+            return false;
+        });
+    }
+
+    aabb bounding_box() const override
+    {
+        return bbox;
+    }
+
+    size_t memory_footprint() const
+    {
+        return sizeof(*this) + accel.memory_footprint() +
+               mesh.vertex_count * ((mesh.normals ? 6 : 3) + (mesh.uvs ? 2 : 0)) * sizeof(float) +
+               mesh.triangle_count * 3 * sizeof(uint32_t);
+    }
+};
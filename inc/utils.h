@@ -1,10 +1,13 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <vector>
-#include <random>
+
+#include "rng.h"
 
 // Usings
 using std::vector;
@@ -22,11 +25,19 @@ inline double deg_to_rad(double deg)
     return deg * PI / 180;
 }
 
+// 64 bit FNV-1a, chain calls through h to hash several values
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t h = 14695981039346656037ull)
+{
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * 1099511628211ull;
+    return h;
+}
+
+// result is in [0, 1), drawn from the calling thread's generator
 inline double random_double()
 {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 engine;
-    return distribution(engine);
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max)
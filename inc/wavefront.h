@@ -0,0 +1,267 @@
+#pragma once
+
+#include "utils.h"
+#include "camera.h"
+#include "film.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+
+#include <array>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief stream (wavefront) path tracer. Instead of following one path to the end, every worker
+ * keeps a queue of paths for its current tile and advances all of them one bounce at a time:
+ *   1. generate camera rays for a batch of samples
+ *   2. intersect the whole queue against the world
+ *   3. sort the hits by material type
+ *   4. sample one light for every diffuse hit
+ *   5. shade every material group in one go
+ *   6. compact the surviving paths into the next bounce's queue
+ * Each path owns its random stream and draws the same numbers as in camera::ray_color, so the
+ * result matches camera::render_progressive up to floating point summation order.
+ *
+ * This is a structural scaffold with no performance gain: the stages are scalar loops, and the
+ * extra passes over the queue make it slower than render_progressive for the same samples. What
+ * it provides is the per-stage, material sorted layout that vectorized stages can build on
+ */
+class wavefront_integrator
+{
+private:
+    struct path_state
+    {
+        ray r;
+        color throughput;
+        color radiance;
+        int x, y;
+        int depth;
+        double scatter_pdf; // see camera::ray_color
+        vec3 scatter_normal;
+        int light;          // light hit by r, -1 if none or not sampled
+        bool alive;
+        pcg32 rng;
+    };
+
+    static constexpr int n_types = static_cast<int>(material_type::count);
+    static constexpr size_t shade_chunk = 64; // hits per scatter_batch() call, small enough to stay in cache
+    using type_offsets = std::array<uint32_t, n_types + 1>;
+
+    const camera &cam;
+
+public:
+    int batch_size = 1 << 14; // max number of paths in flight per worker
+
+    wavefront_integrator(const camera &cam) : cam(cam) {}
+
+    void render(film &accum, const hittable &world, int n_workers = 0) const
+    {
+        using namespace std;
+
+        if (n_workers == 0)
+            n_workers = thread::hardware_concurrency();
+        clog << "Using " << n_workers << " workers (wavefront)" << endl;
+        auto lights = cam.collect_lights(world);
+
+        auto tiles = make_tiles(cam.image_width, cam.image_height, cam.tile_size);
+        const int spp = cam.samples_per_pixel();
+        // split the samples of a tile into batches of at most batch_size paths
+        const int tile_area = cam.tile_size * cam.tile_size;
+        const int samples_per_batch = std::max(1, std::min(spp, batch_size / tile_area));
+
+        mutex log_lock;
+        size_t tiles_done = 0;
+        cam.for_each_tile(tiles, n_workers, [&](const tile &t)
+        {
+            vector<path_state> queue, next_queue;
+            vector<hit_record> hits;
+            vector<uint32_t> order;
+            type_offsets groups;
+            for (int s0 = 0; s0 < spp; s0 += samples_per_batch)
+            {
+                generate(t, s0, std::min(spp, s0 + samples_per_batch), queue);
+                while (!queue.empty())
+                {
+                    intersect(queue, hits, world, lights);
+                    sort_by_material(queue, hits, order, groups, lights, accum);
+                    sample_direct(queue, hits, order, world, lights);
+                    shade(queue, hits, order, groups, lights);
+                    compact(queue, order, next_queue, accum);
+                    std::swap(queue, next_queue);
+                }
+            }
+            lock_guard<mutex> guard(log_lock);
+            clog << "\rRemaining tiles: " << tiles.size() - ++tiles_done << " " << flush;
+        });
+        clog << endl;
+    }
+
+private:
+    // stage 1: one path per (pixel, sample) of the tile
+    void generate(const tile &t, int s0, int s1, std::vector<path_state> &queue) const
+    {
+        queue.clear();
+        for (int y = t.y0; y < t.y1; y++)
+            for (int x = t.x0; x < t.x1; x++)
+                for (int n = s0; n < s1; n++)
+                {
+                    int stratum = n % (cam.samples_per_row * cam.samples_per_row);
+                    seed_sample(static_cast<uint64_t>(y) * cam.image_width + x, n);
+                    path_state path;
+                    path.r = cam.get_ray(x, y, stratum % cam.samples_per_row, stratum / cam.samples_per_row);
+                    path.throughput = color(1, 1, 1);
+                    path.radiance = color(0, 0, 0);
+                    path.x = x;
+                    path.y = y;
+                    path.depth = 0;
+                    path.scatter_pdf = 0;
+                    path.alive = true;
+                    path.rng = thread_rng();
+                    queue.push_back(path);
+                }
+    }
+
+    // stage 2: closest hit for every queued ray, a miss leaves rec.mat empty
+    void intersect(std::vector<path_state> &queue, std::vector<hit_record> &hits, const hittable &world,
+                   const light_list &lights) const
+    {
+        hits.resize(queue.size());
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            auto &path = queue[i];
+            thread_rng() = path.rng; // participating media sample distances during hit()
+            if (world.hit(path.r, interval(0.001, inf), hits[i]))
+            {
+                path.light = path.scatter_pdf > 0 ? lights.find(hits[i]) : -1;
+                hits[i].complete(path.r);
+            }
+            else
+                hits[i].mat = nullptr;
+            path.rng = thread_rng();
+        }
+    }
+
+    /**
+     * @brief stage 3: add background and emission, then counting sort the paths that hit a
+     * scattering material by material type. Misses are finished here. Emission found by scattering
+     * is weighted against light sampling as in camera::ray_color
+     * @param groups returned start of each material type in order, the last entry is the end
+     */
+    void sort_by_material(std::vector<path_state> &queue, const std::vector<hit_record> &hits,
+                          std::vector<uint32_t> &order, type_offsets &groups, const light_list &lights,
+                          film &accum) const
+    {
+        type_offsets offsets{};
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            auto &path = queue[i];
+            auto &rec = hits[i];
+            if (!rec.mat)
+            {
+                path.radiance += path.throughput * cam.background;
+                accum.add_sample(path.x, path.y, path.radiance);
+                continue;
+            }
+            if (rec.mat->is_emitting())
+            {
+                auto light_pdf = lights.pdf(path.light, path.r, path.scatter_normal, rec);
+                auto weight = path.light < 0 ? 1 : power_heuristic(path.scatter_pdf, light_pdf);
+                path.radiance += path.throughput * weight * rec.mat->emitted(rec.u, rec.v, rec.p);
+            }
+            offsets[static_cast<int>(rec.mat->type()) + 1]++;
+        }
+        for (int k = 0; k < n_types; k++)
+            offsets[k + 1] += offsets[k];
+        groups = offsets;
+
+        order.resize(offsets[n_types]);
+        for (size_t i = 0; i < queue.size(); i++)
+            if (hits[i].mat)
+                order[offsets[static_cast<int>(hits[i].mat->type())]++] = i;
+    }
+
+    // stage 4: next event estimation at the diffuse hits, the shadow rays are traced here
+    void sample_direct(std::vector<path_state> &queue, const std::vector<hit_record> &hits,
+                       const std::vector<uint32_t> &order, const hittable &world, const light_list &lights) const
+    {
+        if (lights.empty())
+            return;
+        for (auto i : order)
+        {
+            auto &path = queue[i];
+            if (!hits[i].mat->is_diffuse())
+                continue;
+            thread_rng() = path.rng;
+            path.radiance += path.throughput * lights.sample_direct(path.r, hits[i], world);
+            path.rng = thread_rng();
+        }
+    }
+
+    // stage 5: scatter every sorted path, in batches of one material type
+    void shade(std::vector<path_state> &queue, const std::vector<hit_record> &hits,
+               const std::vector<uint32_t> &order, const type_offsets &groups, const light_list &lights) const
+    {
+        scatter_request requests[shade_chunk];
+        for (int type = 0; type < n_types; type++)
+            for (auto start = groups[type]; start < groups[type + 1]; start += shade_chunk)
+            {
+                auto n = std::min<size_t>(shade_chunk, groups[type + 1] - start);
+                for (size_t k = 0; k < n; k++)
+                {
+                    auto i = order[start + k];
+                    requests[k].r_in = &queue[i].r;
+                    requests[k].rec = &hits[i];
+                    requests[k].rng = &queue[i].rng;
+                }
+                scatter_batch(static_cast<material_type>(type), requests, n);
+                for (size_t k = 0; k < n; k++)
+                    continue_path(queue[order[start + k]], requests[k], lights);
+            }
+    }
+
+    // russian roulette and the next ray of a path after its hit was scattered
+    void continue_path(path_state &path, const scatter_request &q, const light_list &lights) const
+    {
+        thread_rng() = path.rng;
+
+        bool alive = q.alive;
+        if (alive)
+        {
+            path.throughput = path.throughput * q.attenuation;
+            bool sampled = !lights.empty() && q.rec->mat->is_diffuse();
+            path.scatter_pdf = sampled ? q.rec->mat->scattering_pdf(*q.r_in, *q.rec, q.scattered.direction()) : 0;
+            if (sampled)
+                path.scatter_normal = light_list::selection_normal(*q.r_in, *q.rec);
+            if (path.depth >= cam.rr_min_depth)
+            {
+                auto survival = fmin(fmax(path.throughput.x(), fmax(path.throughput.y(), path.throughput.z())), 0.95);
+                if (random_double() >= survival)
+                    alive = false;
+                else
+                    path.throughput /= survival;
+            }
+        }
+        path.depth++;
+        path.alive = alive && path.depth < cam.max_depth;
+        if (path.alive)
+            path.r = q.scattered;
+        path.rng = thread_rng();
+    }
+
+    // stage 6: retire finished paths into the film, keep the others in material order
+    void compact(const std::vector<path_state> &queue, const std::vector<uint32_t> &order,
+                 std::vector<path_state> &next_queue, film &accum) const
+    {
+        next_queue.clear();
+        for (auto i : order)
+        {
+            auto &path = queue[i];
+            if (path.alive)
+                next_queue.push_back(path);
+            else
+                accum.add_sample(path.x, path.y, path.radiance);
+        }
+    }
+};
\ No newline at end of file
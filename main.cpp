@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 
 #include "CImg.h"
@@ -11,17 +12,22 @@
 #include "texture.h"
 #include "quad.h"
 #include "constant_medium.h"
+#include "instance.h"
+#include "arena.h"
+#include "scene.h"
 
 using namespace cimg_library;
 
 void random_spheres()
 {
     // World
+    auto arena = scene_arena::create();
+    // the spheres are copied into the bvh, the originals are freed with the list
     hittable_list world;
 
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+    auto checker = arena->make<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    auto ground_material = arena->make<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, arena->make<lambertian>(checker)));
 
     for (int a = -11; a < 11; a++)
     {
@@ -38,7 +44,7 @@ void random_spheres()
                 {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
+                    sphere_material = arena->make<lambertian>(albedo);
                     auto center2 = center + vec3(0, random_double(0, 0.5), 0);
                     world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
                 }
@@ -47,29 +53,31 @@ void random_spheres()
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    sphere_material = arena->make<metal>(albedo, fuzz);
                     world.add(make_shared<sphere>(center, 0.2, sphere_material));
                 }
                 else
                 {
                     // glass
-                    sphere_material = make_shared<dielectric>(1.5);
+                    sphere_material = arena->make<dielectric>(1.5);
                     world.add(make_shared<sphere>(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
+    auto material1 = arena->make<dielectric>(1.5);
     world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    auto material2 = arena->make<lambertian>(color(0.4, 0.2, 0.1));
     world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    auto material3 = arena->make<metal>(color(0.7, 0.6, 0.5), 0.0);
     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
-    world = hittable_list(make_shared<bvh>(world));
+    auto tree = arena->make<bvh>(world);
+    tree->report(std::clog);
+    world = hittable_list(tree);
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;
@@ -92,269 +100,105 @@ void random_spheres()
     image.save_png("random_spheres.png");
 }
 
-void two_spheres()
+/**
+ * @brief noise of a progressive render: root mean square of the standard error of the gamma
+ * corrected pixels, leaving out saturated ones whose error the display clips anyway
+ */
+double display_error(const film &accum)
 {
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.2, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 800;
-    cam.samples_per_row = 4;
-    cam.samples_per_subpixel = 4;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-    cam.initialize();
-
-    CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, world);
-    image.save_png("two_spheres.png");
-}
-
-void earth()
-{
-    auto earth_texture = make_shared<image_texture>("earthmap.png");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_row = 4;
-    cam.samples_per_subpixel = 4;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(0, 0, 12);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-    cam.initialize();
-
-    CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, hittable_list(globe));
-    image.save_png("globe.png");
-}
-
-void two_perlin_spheres()
-{
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(3, 3.0, 4);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 800;
-    cam.samples_per_row = 4;
-    cam.samples_per_subpixel = 4;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-    cam.initialize();
-
-    CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, world);
-    image.save_png("two_perlin_spheres.png");
+    double sum = 0;
+    long n = 0;
+    for (int y = 0; y < accum.get_height(); y++)
+        for (int x = 0; x < accum.get_width(); x++)
+        {
+            auto mean = luminance(accum.value(x, y));
+            if (mean > 1)
+                continue;
+            // error of sqrt(mean) from the error of the mean
+            auto error = accum.standard_error(x, y) / (2 * sqrt(fmax(mean, 1e-3)));
+            sum += error * error;
+            n++;
+        }
+    return n ? sqrt(sum / n) : 0;
 }
 
-void quads()
+/**
+ * 10000 small lights of random color and strength over a field of diffuse spheres. Rendered once
+ * with uniform light selection and once with the light tree, logging the noise of both and the
+ * noise they reach in equal time
+ */
+void many_lights()
 {
+    auto arena = scene_arena::create();
+    // the shapes are copied into the bvh, the originals are freed with the list
     hittable_list world;
 
-    // Materials
-    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 400;
-    cam.samples_per_row = 4;
-    cam.samples_per_subpixel = 4;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 80;
-    cam.lookfrom = point3(0, 0, 9);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-    cam.initialize();
-
-    CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, world);
-    image.save_png("quads.png");
-}
-
-void simple_light()
-{
-    hittable_list world;
+    auto ground = arena->make<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<quad>(point3(-50, 0, -50), vec3(100, 0, 0), vec3(0, 0, 100), ground));
+    for (int i = 0; i < 40; i++)
+    {
+        auto radius = random_double(0.5, 2);
+        point3 center(random_double(-30, 30), radius, random_double(-30, 10));
+        world.add(make_shared<sphere>(center, radius, arena->make<lambertian>(color::random(0.2, 0.9))));
+    }
 
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+    int n_lights = 10000;
+    for (int i = 0; i < n_lights; i++)
+    {
+        auto light = arena->make<diffuse_light>(random_double(1, 20) * unit(color::random(0.05, 1)));
+        point3 p(random_double(-40, 40), random_double(0.3, 8), random_double(-40, 15));
+        // one in four is a small horizontal square, the others are small spheres
+        if (i % 4 == 0)
+            world.add(make_shared<quad>(p, vec3(0.2, 0, 0), vec3(0, 0, 0.2), light));
+        else
+            world.add(make_shared<sphere>(p, 0.06, light));
+    }
 
-    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-    world.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
-    world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+    auto tree = arena->make<bvh>(world);
+    tree->report(std::clog);
+    world = hittable_list(tree);
 
     camera cam;
-
     cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 800;
-    cam.samples_per_row = 4;
-    cam.samples_per_subpixel = 4;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(26, 3, 6);
-    cam.lookat = point3(0, 2, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-    cam.initialize();
-
-    CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, world);
-    image.save_png("simple_light.png");
-}
-
-void cornell_box()
-{
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
-
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    world.add(box2);
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 800;
+    cam.image_width = 400;
     cam.samples_per_row = 4;
-    cam.samples_per_subpixel = 4;
-    cam.max_depth = 50;
+    cam.samples_per_subpixel = 1;
+    cam.max_depth = 20;
     cam.background = color(0, 0, 0);
 
     cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
+    cam.lookfrom = point3(0, 6, 24);
+    cam.lookat = point3(0, 1, 0);
     cam.vup = vec3(0, 1, 0);
 
-    cam.defocus_angle = 0;
-    cam.initialize();
-
-    CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, world);
-    image.save_png("cornell.png");
-}
-
-void cornell_smoke() {
-    hittable_list world;
-
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-    world.add(make_shared<quad>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quad>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
-    world.add(make_shared<quad>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-
-    shared_ptr<hittable> box2 = box(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
-
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 600;
-    cam.samples_per_row = 4;
-    cam.samples_per_subpixel = 4;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat   = point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
     cam.initialize();
 
-    CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, world);
-    image.save_png("cornell_smoke.png");
+    for (bool tree : {false, true})
+    {
+        cam.light_tree = tree;
+        film accum(cam.image_width, cam.image_height);
+        auto start = std::chrono::steady_clock::now();
+        cam.render_progressive(accum, world);
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+        // noise falls with the square root of the time spent
+        auto error = display_error(accum);
+        std::clog << (tree ? "Light tree: " : "Uniform selection: ") << seconds.count() << " s, error " << error
+                  << ", error after 1 s " << error * sqrt(seconds.count()) << std::endl;
+
+        CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
+        accum.resolve(image);
+        image.save_png(tree ? "many_lights.png" : "many_lights_uniform.png");
+    }
 }
 
 void final_scene()
 {
+    auto arena = scene_arena::create();
     hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    auto ground = arena->make<lambertian>(color(0.48, 0.83, 0.53));
+    // every ground box is an instance of one unit box, the top level bvh only holds instances
+    auto unit_box = arena->make<bvh>(*box(point3(0, 0, 0), point3(1, 1, 1), ground));
 
     int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i++)
@@ -369,50 +213,53 @@ void final_scene()
             auto y1 = random_double(1, 101);
             auto z1 = z0 + w;
 
-            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+            boxes1.add(arena->make<instance>(unit_box, affine::translation(vec3(x0, y0, z0)) *
+                                                           affine::scaling(vec3(x1 - x0, y1 - y0, z1 - z0))));
         }
     }
 
     hittable_list world;
 
-    world.add(make_shared<bvh_node>(boxes1));
+    auto ground_bvh = arena->make<bvh>(boxes1);
+    ground_bvh->report(std::clog);
+    world.add(ground_bvh);
 
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
+    auto light = arena->make<diffuse_light>(color(7, 7, 7));
+    world.add(arena->make<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
 
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30, 0, 0);
-    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
+    auto sphere_material = arena->make<lambertian>(color(0.7, 0.3, 0.1));
+    world.add(arena->make<sphere>(center1, center2, 50, sphere_material));
 
-    world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)));
+    world.add(arena->make<sphere>(point3(260, 150, 45), 50, arena->make<dielectric>(1.5)));
+    world.add(arena->make<sphere>(
+        point3(0, 150, 145), 50, arena->make<metal>(color(0.8, 0.8, 0.9), 1.0)));
 
-    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
+    auto boundary = arena->make<sphere>(point3(360, 150, 145), 70, arena->make<dielectric>(1.5));
     world.add(boundary);
-    auto inner_boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
-    world.add(make_shared<constant_medium>(inner_boundary, 0.01, color(0.2, 0.4, 0.8)));
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<lambertian>(color(0, 0, 0)));
-    world.add(make_shared<constant_medium>(boundary, .0001, color(1, 1, 1)));
+    auto inner_boundary = arena->make<sphere>(point3(360, 150, 145), 70, arena->make<dielectric>(1.5));
+    world.add(arena->make<constant_medium>(inner_boundary, 0.01, color(0.2, 0.4, 0.8)));
+    boundary = arena->make<sphere>(point3(0, 0, 0), 5000, arena->make<lambertian>(color(0, 0, 0)));
+    world.add(arena->make<constant_medium>(boundary, .0001, color(1, 1, 1)));
 
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.png"));
-    world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.1, 10.0, 0);
-    world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+    auto emat = arena->make<lambertian>(arena->make<image_texture>("earthmap.png"));
+    world.add(arena->make<sphere>(point3(400, 200, 400), 100, emat));
+    auto pertext = arena->make<noise_texture>(0.1, 10.0, 0);
+    world.add(arena->make<sphere>(point3(220, 280, 300), 80, arena->make<lambertian>(pertext)));
 
     hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto white = arena->make<lambertian>(color(.73, .73, .73));
     int ns = 1000;
     for (int j = 0; j < ns; j++)
     {
         boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
     }
 
-    world.add(make_shared<translate>(
-        make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2), 15),
-        vec3(-100, 270, 395)));
+    auto cluster_bvh = arena->make<bvh>(boxes2);
+    cluster_bvh->report(std::clog);
+    boxes2.clear(); // the bvh holds copies of the spheres
+    world.add(arena->make<instance>(cluster_bvh, affine::translation(vec3(-100, 270, 395)) * affine::rotation_y(15)));
 
     camera cam;
 
@@ -431,45 +278,46 @@ void final_scene()
     cam.defocus_angle = 0;
     cam.initialize();
 
+    // spend the sample budget where the fog and glass are still noisy
+    cam.adaptive_threshold = 0.02;
+
+    // long render: accumulate progressively and checkpoint, rerun to resume after an interruption
+    film accum(cam.image_width, cam.image_height);
+    // the geometry is fixed in code, so the name identifies the scene for the checkpoint
+    const std::string scene_name = "final_scene";
+    cam.render_progressive(accum, world, scene_name + ".ckpt", hash_bytes(scene_name.data(), scene_name.size()));
+
     CImg<unsigned char> image(cam.image_width, cam.image_height, 1, 3);
-    cam.render(image, world);
+    accum.resolve(image);
     image.save_png("final_scene.png");
 }
 
-int main()
+/**
+ * Renders the scenes named on the command line, each either a scene file (see scene.h and the
+ * scenes directory) or one of the procedurally generated scenes below. Without arguments the
+ * final scene is rendered
+ */
+int main(int argc, char **argv)
 {
-    int scene_id = 9;
-    switch (scene_id)
+    vector<std::string> names(argv + 1, argv + argc);
+    if (names.empty())
+        names.push_back("final_scene");
+
+    for (const auto &name : names)
     {
-    case 1:
-        random_spheres();
-        break;
-    case 2:
-        two_spheres();
-        break;
-    case 3:
-        earth();
-        break;
-    case 4:
-        two_perlin_spheres();
-        break;
-    case 5:
-        quads();
-        break;
-    case 6:
-        simple_light();
-        break;
-    case 7:
-        cornell_box();
-        break;
-    case 8:
-        cornell_smoke();
-        break;
-    case 9:
-        final_scene();
-        break;
-    default:
-        break;
+        if (name == "random_spheres")
+            random_spheres();
+        else if (name == "final_scene")
+            final_scene();
+        else if (name == "many_lights")
+            many_lights();
+        else
+        {
+            scene s;
+            if (!s.load(name))
+                return 1;
+            s.render();
+        }
     }
     return 0;
-}
\ No newline at end of file
+}